@@ -1,30 +1,36 @@
-import time, importlib, inspect, os, json
+import asyncio, time, os, json, inspect
 import traceback
 from typing import Optional, Dict, TypedDict
-from tools.helpers import extract_tools, rate_limiter, files, errors
+from tools.helpers import extract_tools, rate_limiter, files, errors, pipeline, tool_registry, loop_detector, budget
 from tools.helpers.print_style import PrintStyle
 from langchain.schema import AIMessage
 from langchain_core.prompts import ChatPromptTemplate, MessagesPlaceholder
-from langchain_core.messages import HumanMessage, SystemMessage
+from langchain_core.messages import HumanMessage, SystemMessage, BaseMessage
 from langchain_core.language_models.chat_models import BaseChatModel
 from langchain_core.embeddings import Embeddings
 from tools.helpers.rate_limiter import RateLimiter
+from tools.helpers.control import Control
+import models
 
 # rate_limit = rate_limiter.rate_limiter(30,160000) #TODO! implement properly
 
 
 class Agent:
 
-    paused=False
-    streaming_agent=None
-    
     def __init__(self,
                 agent_number: int,
                 chat_model:BaseChatModel,
                 embeddings_model:Embeddings,
                 memory_subdir: str = "",
+                memory_backend: str = "chroma",
+                memory_persist_queries: bool = False,
                 auto_memory_count: int = 3,
                 auto_memory_skip: int = 2,
+                auto_memory_window: int = 6,
+                auto_memory_decay: float = 0.7,
+                auto_memory_threshold: float = 0.0,
+                auto_memory_summarize: bool = False,
+                auto_memory_drift: float = 0.15,
                 rate_limit_seconds: int = 60,
                 rate_limit_requests: int = 30,
                 rate_limit_input_tokens: int = 0,
@@ -32,7 +38,26 @@ class Agent:
                 msgs_keep_max: int = 25,
                 msgs_keep_start: int = 5,
                 msgs_keep_end: int = 10,
+                msgs_keep_tokens: int = 0,
+                msgs_summary_window: int = 6,
+                msgs_summary_fanout: int = 4,
+                msgs_cleanup_threshold: float = 0.8,
                 max_tool_response_length: int = 3000,
+                stop_sequences: list[str] | None = None,
+                speculative_tools: bool = True,
+                memory_prefetch_timeout: float = 1.0,
+                max_parallel_tools: int = 4,
+                control: Control | None = None,
+                work_dir: str = "work_dir",
+                work_dir_tmpfs: bool = False,
+                loop_window: int = 8,
+                loop_threshold: int = 2,
+                loop_max_distance: int = 3,
+                budget_seconds: float = 0,
+                budget_calls: int = 0,
+                budget_input_tokens: int = 0,
+                budget_output_tokens: int = 0,
+                budget_cost: float = 0,
                 **kwargs):
 
         # agent config
@@ -40,8 +65,15 @@ class Agent:
         self.chat_model = chat_model
         self.embeddings_model = embeddings_model
         self.memory_subdir = memory_subdir
+        self.memory_backend = memory_backend # "chroma" or "hnsw"
+        self.memory_persist_queries = memory_persist_queries # keep query embeddings on disk across restarts, never evicted there
         self.auto_memory_count = auto_memory_count
         self.auto_memory_skip = auto_memory_skip
+        self.auto_memory_window = auto_memory_window # last messages the recall query is built from
+        self.auto_memory_decay = auto_memory_decay # weight of each older message relative to the next newer one
+        self.auto_memory_threshold = auto_memory_threshold # minimum reranker score of an injected memory
+        self.auto_memory_summarize = auto_memory_summarize # let the chat model summarize the top hits before injection
+        self.auto_memory_drift = auto_memory_drift # cosine distance from the last recall vector that counts as a new topic
         self.rate_limit_seconds = rate_limit_seconds
         self.rate_limit_requests = rate_limit_requests
         self.rate_limit_input_tokens = rate_limit_input_tokens
@@ -49,112 +81,226 @@ class Agent:
         self.msgs_keep_max = msgs_keep_max
         self.msgs_keep_start = msgs_keep_start
         self.msgs_keep_end = msgs_keep_end
+        self.msgs_keep_tokens = msgs_keep_tokens
+        self.msgs_summary_window = msgs_summary_window
+        self.msgs_summary_fanout = msgs_summary_fanout
+        self.msgs_cleanup_threshold = msgs_cleanup_threshold
         self.max_tool_response_length = max_tool_response_length
+        self.stop_sequences = stop_sequences if stop_sequences is not None else ["\n~~~\n"] # closing code fence after the JSON, the parser ends the stream on the closing brace anyway
+        self.speculative_tools = speculative_tools
+        self.memory_prefetch_timeout = memory_prefetch_timeout
+        self.max_parallel_tools = max_parallel_tools
+        if control is None: raise ValueError("Agent needs a session, create one with tools.helpers.control.create_session().")
+        self.control = control # session state shared by the whole agent tree
+        self.work_dir = work_dir
+        self.work_dir_tmpfs = work_dir_tmpfs
+        self.loop_window = loop_window
+        self.loop_threshold = loop_threshold
+        self.loop_max_distance = loop_max_distance
+        self.budget_seconds = budget_seconds # limits per task (one message loop), 0 = unlimited
+        self.budget_calls = budget_calls
+        self.budget_input_tokens = budget_input_tokens
+        self.budget_output_tokens = budget_output_tokens
+        self.budget_cost = budget_cost
 
         # non-config vars
         self.agent_name = f"Agent {self.agent_number}"
+        self.id = self.control.register(self) # address of this agent within its session
+        self.price_warning_shown = False
+        self.work_dir_path = files.get_work_dir(work_dir, tmpfs=work_dir_tmpfs) # absolute, passed as cwd instead of changing the process CWD
 
-        self.system_prompt = files.read_file("./prompts/agent.system.md").replace("{", "{{").replace("}", "}}")
-        self.tools_prompt = files.read_file("./prompts/agent.tools.md").replace("{", "{{").replace("}", "}}")
+        self.system_prompt = files.read_file("./prompts/agent.system.md")
+        self.tools_prompt = files.read_file("./prompts/agent.tools.md")
+        self.static_prompt = self.system_prompt + "\n\n" + self.tools_prompt # byte-stable prefix, never changes during the session
+        self.tokenizer = models.get_tokenizer(chat_model)
+        self.static_prompt_tokens = self.tokenizer.count(self.static_prompt)
+
+        self.rate_limiter = RateLimiter(max_calls=rate_limit_requests,max_input_tokens=rate_limit_input_tokens,max_output_tokens=rate_limit_output_tokens,window_seconds=rate_limit_seconds)
+        self.reset()
+
+    def reset(self):
+        # clear the conversation state, the agent can then be reused for a new task with the same config
+        for task in (getattr(self, "memory_task", None), getattr(self, "cleanup_task", None)):
+            if task: self.discard_task(task)
+        if getattr(self, "speculation", None): self.cancel_speculation()
+        if getattr(self, "data", None) and self.data.get("memory_db"):
+            from tools import memory_tool
+            memory_tool.release_db(self) # private memory of the finished task
 
         self.history = []
         self.last_message = ""
-        self.intervention_message = ""
+        self.control.clear_interventions(self.id)
         self.intervention_status = False
-        self.rate_limiter = RateLimiter(max_calls=rate_limit_requests,max_input_tokens=rate_limit_input_tokens,max_output_tokens=rate_limit_output_tokens,window_seconds=rate_limit_seconds)
         self.data = {} # free data object all the tools can use
-
-        os.chdir(files.get_abs_path("./work_dir")) #change CWD to work_dir
+        self.speculation = None # side-effect-free tool started while its message is still streaming
+        self.memories = "" # memory block injected into the prompt
+        self.memory_task = None # background memory recall
+        self.memory_vector = None # recall vector the current memory block was retrieved with
+        self.memory_version = 0 # memory database version at that time
+        self.memory_skip_counter = 0
+        self.cleanup_task = None # background summarization of the middle of the history
+        self.summaries: list[list[str]] = [] # summary tree, level 0 covers message windows, higher levels merge lower ones
+        self.summary_message = None # history message holding the rendered summaries
+        self.loop_detector = loop_detector.LoopDetector(self.loop_window, self.loop_threshold, self.loop_max_distance)
+        self.loop_level = loop_detector.NONE # highest escalation reported by the tools of the current iteration
+        self.budget = None # budget of the running task, a share of the superior's budget for subordinates
+
+    def get_config(self) -> dict:
+        # constructor arguments of this agent, used to create or look up agents with the same setup
+        params = inspect.signature(Agent.__init__).parameters
+        return {name: getattr(self, name) for name, param in params.items() if name != "self" and param.kind != param.VAR_KEYWORD}
         
 
     def message_loop(self, msg: str):
+        return asyncio.run(self.amessage_loop(msg)) # sync entry point, runs the async engine in its own event loop
+
+    async def amessage_loop(self, msg: str):
         try:
             printer = PrintStyle(italic=True, font_color="#b3ffd9", padding=False)    
             user_message = files.read_file("./prompts/fw.user_message.md", message=msg)
-            self.append_message(user_message, human=True) # Append the user's input to the history                        
-            memories = self.fetch_memories(True)
+            await self.append_message(user_message, human=True) # Append the user's input to the history                        
+            self.budget = budget.Budget(self.budget_seconds, self.budget_calls, self.budget_input_tokens, self.budget_output_tokens, self.budget_cost,
+                                        parent=self.get_data("budget")) # share handed over by the superior, if any
+            self.prefetch_memories(True)
                 
             while True: # let the agent iterate on his thoughts until he stops by using a tool
-                Agent.streaming_agent = self #mark self as current streamer
+                self.control.set_streaming(self) #mark self as current streamer
                 agent_response = ""
                 self.intervention_status = False # reset interventon status
+                self.loop_level = loop_detector.NONE
+                self.cancel_speculation() # drop leftovers from the previous iteration
 
                 try:
 
-                    system = self.system_prompt + "\n\n" + self.tools_prompt
-                    memories = self.fetch_memories()
-                    if memories: system+= "\n\n"+memories
+                    await self.enforce_history_limit()
+                    memories = await self.get_memories()
+                    prompt = self.build_prompt(memories)
 
-                    prompt = ChatPromptTemplate.from_messages([
-                        SystemMessage(content=system),
-                        MessagesPlaceholder(variable_name="messages") ])
-                    
-                    inputs = {"messages": self.history}
-                    chain = prompt | self.chat_model
-
-                    formatted_inputs = prompt.format(messages=self.history)
-                    tokens = int(len(formatted_inputs)/4)     
-                    self.rate_limiter.limit_call_and_input(tokens)
+                    tokens = self.static_prompt_tokens + self.get_history_tokens() + self.tokenizer.count(memories)
+                    exceeded = self.budget.get_exceeded(tokens)
+                    if exceeded: return self.stop_on_budget(exceeded) # the next call would not fit, return what we have
+                    call_record = await self.rate_limiter.alimit_call_and_input(tokens)
+                    usage = {}
                     
                     # output that the agent is starting
                     PrintStyle(bold=True, font_color="green", padding=True, background_color="white").print(f"{self.agent_name}: Starting a message:")
                                             
-                    for chunk in chain.stream(inputs):
-                        if self.handle_intervention(agent_response): break # wait for intervention and handle it, if paused
-
-                        if isinstance(chunk, str): content = chunk
-                        elif hasattr(chunk, "content"): content = str(chunk.content)
-                        else: content = str(chunk)
-                        
-                        if content:
-                            printer.stream(content) # output the agent response stream                
-                            agent_response += content # concatenate stream into the response
-
-                    self.rate_limiter.set_output_tokens(int(len(agent_response)/4))
+                    parser = extract_tools.JsonStreamParser()
+                    stream = self.chat_model.astream(prompt, stop=self.stop_sequences or None)
+                    stream_complete = False
+                    try:
+                        async for chunk in stream:
+                            if await self.handle_intervention(agent_response): break # wait for intervention and handle it, if paused
+                            models.add_usage(usage, chunk) # collect provider-reported token usage
+
+                            if isinstance(chunk, str): content = chunk
+                            elif hasattr(chunk, "content"): content = str(chunk.content)
+                            else: content = str(chunk)
+                            
+                            if content:
+                                complete = parser.feed(content) # watch for the end of the tool call object
+                                if complete: content = content[:len(content) - (len(parser.text) - parser.end)] # drop anything after the closing brace
+                                printer.stream(content) # output the agent response stream                
+                                agent_response += content # concatenate stream into the response
+                                self.start_speculation(parser)
+                                if complete: break # tool call is complete, do not wait for trailing output
+                        else: stream_complete = True # read to the end, the final usage chunk was seen
+                    finally:
+                        await stream.aclose() # closes the provider stream when we stop early
+
+                    # the loop usually stops at the end of the tool call, before a final usage chunk, then the reported input count
+                    # (if the provider sends it up front) replaces the estimate and output is counted from the text received;
+                    # providers reporting only at the end keep the input estimate made before the call
+                    input_tokens, output_tokens = models.get_reported_usage(usage, stream_complete)
+                    self.rate_limiter.reconcile(call_record, input_tokens, output_tokens if output_tokens is not None else self.tokenizer.count(agent_response))
+                    self.charge_budget(call_record)
                     
-                    if not self.handle_intervention(agent_response):
+                    if not await self.handle_intervention(agent_response):
                         if self.last_message == agent_response: #if assistant_response is the same as last message in history, let him know
-                            self.append_message(agent_response) # Append the assistant's response to the history
+                            await self.append_message(agent_response) # Append the assistant's response to the history
                             warning_msg = files.read_file("./prompts/fw.msg_repeat.md")
-                            self.append_message(warning_msg, human=True) # Append warning message to the history
+                            await self.append_message(warning_msg, human=True) # Append warning message to the history
                             PrintStyle(font_color="orange", padding=True).print(warning_msg)
 
                         else: #otherwise proceed with tool
-                            self.append_message(agent_response) # Append the assistant's response to the history
-                            tools_result = self.process_tools(agent_response) # process tools requested in agent message
+                            await self.append_message(agent_response) # Append the assistant's response to the history
+                            tools_result = await self.process_tools(agent_response) # process tools requested in agent message
                             if tools_result: return tools_result #break the execution if the task is done
+                            loop_result = await self.handle_loop() # warn or abort when the same calls keep giving the same results
+                            if loop_result: return loop_result
 
                 # Forward errors to the LLM, maybe he can fix them
                 except Exception as e:
                     error_message = errors.format_error(e)
                     msg_response = files.read_file("./prompts/fw.error.md", error=error_message) # error message template
-                    self.append_message(msg_response, human=True)
+                    await self.append_message(msg_response, human=True)
                     PrintStyle(font_color="red", padding=True).print(msg_response)
+
+                self.prefetch_memories() # start recall for the next iteration right after the last message is appended
                     
         finally:
-            Agent.streaming_agent = None # unset current streamer
+            self.cancel_speculation()
+            if self.memory_task: self.discard_task(self.memory_task)
+            if self.cleanup_task: self.discard_task(self.cleanup_task)
+            self.memory_task = self.cleanup_task = None
+            self.control.clear_streaming(self) # unset current streamer
+
+    def build_prompt(self, memories: str = "") -> list[BaseMessage]:
+        # Layout is static prefix -> history -> memories, so everything up to the end of the history
+        # stays byte-identical between iterations and provider prefix caches keep hitting.
+        # Memories are only attached to the outgoing request, never stored in the history.
+        cache_control = models.get_cache_control(self.chat_model)
+
+        if cache_control:
+            system = SystemMessage(content=[{"type": "text", "text": self.static_prompt, "cache_control": cache_control}])
+        else:
+            system = SystemMessage(content=self.static_prompt)
+
+        history = list(self.history)
+        if history and history[-1].type == "human":
+            last = history.pop().content
+        else:
+            last = ""
+
+        if cache_control:
+            blocks = [{"type": "text", "text": last, "cache_control": cache_control}] if last else []
+            if memories: blocks.append({"type": "text", "text": memories})
+            if blocks: history.append(HumanMessage(content=blocks)) # type: ignore
+        elif last or memories:
+            history.append(HumanMessage(content="\n\n".join(part for part in (last, memories) if part)))
+
+        return [system] + history
 
     def get_data(self, field:str):
         return self.data.get(field, None)
 
+    def get_work_dir(self) -> str:
+        # a task can override the directory through the data object, e.g. parallel subordinates
+        return self.get_data("work_dir") or self.work_dir_path
+
     def set_data(self, field:str, value):
         self.data[field] = value
 
-    def append_message(self, msg: str, human: bool = False):
+    async def append_message(self, msg: str, human: bool = False):
         message_type = "human" if human else "ai"
         if self.history and self.history[-1].type == message_type:
             self.history[-1].content += "\n\n" + msg
         else:
             new_message = HumanMessage(content=msg) if human else AIMessage(content=msg)
             self.history.append(new_message)
-            self.cleanup_history(self.msgs_keep_max, self.msgs_keep_start, self.msgs_keep_end)
+        self.cleanup_history(self.msgs_keep_max, self.msgs_keep_start, self.msgs_keep_end)
         if message_type=="ai":
             self.last_message = msg
 
+    def get_history_tokens(self):
+        return sum(models.count_message_tokens(msg, self.tokenizer) for msg in self.history)
+
     def concat_messages(self,messages):
         return "\n".join([f"{msg.type}: {msg.content}" for msg in messages])
 
-    def send_adhoc_message(self, system: str, msg: str, output_label:str):
+    async def send_adhoc_message(self, system: str, msg: str, output_label:str, background: bool = False):
+        # background calls (memory recall, history compaction) only wait while paused,
+        # interventions are left for the message loop and the stream is never cut short
         prompt = ChatPromptTemplate.from_messages([
             SystemMessage(content=system),
             HumanMessage(content=msg)])
@@ -167,12 +313,15 @@ class Agent:
             PrintStyle(bold=True, font_color="orange", padding=True, background_color="white").print(f"{self.agent_name}: {output_label}:")
             printer = PrintStyle(italic=True, font_color="orange", padding=False)                
 
-        formatted_inputs = prompt.format()
-        tokens = int(len(formatted_inputs)/4)     
-        self.rate_limiter.limit_call_and_input(tokens)
+        tokens = self.tokenizer.count(system) + self.tokenizer.count(msg)
+        call_record = await self.rate_limiter.alimit_call_and_input(tokens)
+        usage = {}
+        stream_complete = False
     
-        for chunk in chain.stream({}):
-            if self.handle_intervention(): break # wait for intervention and handle it, if paused
+        async for chunk in chain.astream({}):
+            if background: await self.control.wait_resumed()
+            elif await self.handle_intervention(): break # wait for intervention and handle it, if paused
+            models.add_usage(usage, chunk)
 
             if isinstance(chunk, str): content = chunk
             elif hasattr(chunk, "content"): content = str(chunk.content)
@@ -180,107 +329,365 @@ class Agent:
 
             if printer: printer.stream(content)
             response+=content
+        else: stream_complete = True
 
-        self.rate_limiter.set_output_tokens(int(len(response)/4))
+        input_tokens, output_tokens = models.get_reported_usage(usage, stream_complete)
+        self.rate_limiter.reconcile(call_record, input_tokens, output_tokens if output_tokens is not None else self.tokenizer.count(response))
+        self.charge_budget(call_record)
 
         return response
+
+    def charge_budget(self, call_record: rate_limiter.CallRecord):
+        if not self.budget: return
+        cost = models.get_cost(self.chat_model, call_record.input_tokens, call_record.output_tokens)
+        if cost is None:
+            cost = 0.0
+            if self.budget.has_cost_limit() and not self.price_warning_shown:
+                self.price_warning_shown = True
+                PrintStyle(font_color="orange", padding=True).print(f"{self.agent_name}: no price known for model \"{models.get_model_name(self.chat_model)}\", its calls do not count against the cost limit. Add it to models.prices.")
+        self.budget.charge(call_record.input_tokens, call_record.output_tokens, cost)
+
+    def stop_on_budget(self, reason: str) -> str:
+        # partial result: the last exchange of the task, the caller decides whether to continue with a new budget
+        progress = self.concat_messages(self.history[-2:])
+        if len(progress) > self.max_tool_response_length: progress = progress[-self.max_tool_response_length:]
+        result = files.read_file("./prompts/fw.budget_exceeded.md", reason=reason, progress=progress)
+        PrintStyle(font_color="red", padding=True).print(result)
+        return result
             
     def get_last_message(self):
         if self.history:
             return self.history[-1]
 
-    def replace_middle_messages(self,middle_messages):
-        cleanup_prompt = files.read_file("./prompts/fw.msg_cleanup.md")
-        summary = self.send_adhoc_message(system=cleanup_prompt,msg=self.concat_messages(middle_messages), output_label="Mid messages cleanup summary")
-        new_human_message = HumanMessage(content=summary)
-        return [new_human_message]
-
     def cleanup_history(self, max:int, keep_start:int, keep_end:int):
-        if len(self.history) <= max:
+        # Compaction runs in the background and starts before the hard limits are reached,
+        # the loop keeps going with the full history until the new summary is ready.
+        if self.cleanup_task and not self.cleanup_task.done():
             return self.history
 
-        first_x = self.history[:keep_start]
-        last_y = self.history[-keep_end:]
-
-        # Identify the middle part
-        middle_part = self.history[keep_start:-keep_end]
-
-        # Ensure the first message in the middle is "human", if not, move one message back
-        if middle_part and middle_part[0].type != "human":
-            if len(first_x) > 0:
-                middle_part.insert(0, first_x.pop())
-
-        # Ensure the middle part has an odd number of messages
-        if len(middle_part) % 2 == 0:
-            middle_part = middle_part[:-1]
+        over_count = len(self.history) > max * self.msgs_cleanup_threshold
+        over_tokens = self.msgs_keep_tokens > 0 and self.get_history_tokens() > self.msgs_keep_tokens * self.msgs_cleanup_threshold
+        if not over_count and not over_tokens:
+            return self.history
 
-        # Replace the middle part using the replacement function
-        new_middle_part = self.replace_middle_messages(middle_part)
+        window = self.get_summary_window(keep_start, keep_end)
+        if window:
+            self.cleanup_task = asyncio.create_task(self.compact_history(window))
+        return self.history
 
-        self.history = first_x + new_middle_part + last_y
+    def get_summary_window(self, keep_start:int, keep_end:int):
+        # Next block of raw messages to summarize, taken right after the summary message,
+        # so every compaction only covers new content.
+        summary_index = next((i for i, msg in enumerate(self.history) if msg is self.summary_message), -1)
+        if summary_index != -1:
+            start = summary_index + 1 # first message is "ai", the block has to end with "human" so the summary is followed by "ai"
+            parity = 0
+        else:
+            start = keep_start
+            if start > 0 and start < len(self.history) and self.history[start].type != "human": start -= 1 # block has to start with "human"
+            parity = 1 # and end with "human" too, so it is replaced by one human message
 
-        return self.history
+        size = min(self.msgs_summary_window, len(self.history) - keep_end - start)
+        if size % 2 != parity: size -= 1
+        if size <= 0: return []
+        return self.history[start:start+size]
 
-    def handle_intervention(self, progress:str="") -> bool:
-        while self.paused: time.sleep(0.1) # wait if paused
-        if self.intervention_message and not self.intervention_status: # if there is an intervention message, but not yet processed
-            if progress.strip(): self.append_message(progress) # append the response generated so far
-            user_msg = files.read_file("./prompts/fw.intervention.md", user_message=self.intervention_message) # format the user intervention template
-            self.append_message(user_msg,human=True) # append the intervention message
-            self.intervention_message = "" # reset the intervention message
-            self.intervention_status = True
+    async def compact_history(self, window):
+        try:
+            levels = [list(level) for level in self.summaries] or [[]]
+
+            # level 0 summary of the new messages
+            cleanup_prompt = files.read_file("./prompts/fw.msg_cleanup.md")
+            summary = await self.send_adhoc_message(system=cleanup_prompt, msg=self.concat_messages(window), output_label="", background=True)
+            if not summary.strip(): return False # nothing usable, keep the original messages
+            levels[0].append(summary)
+
+            # full levels are merged into one summary on the next level, each merge covers a fixed number of summaries
+            merge_prompt = files.read_file("./prompts/fw.msg_summary_merge.md")
+            level = 0
+            while len(levels[level]) >= self.msgs_summary_fanout:
+                merged = await self.send_adhoc_message(system=merge_prompt, msg="\n\n".join(levels[level][:self.msgs_summary_fanout]), output_label="", background=True)
+                if not merged.strip(): return False
+                levels[level] = levels[level][self.msgs_summary_fanout:]
+                if level + 1 == len(levels): levels.append([])
+                levels[level + 1].append(merged)
+                level += 1
+        except Exception as e:
+            PrintStyle(font_color="red", padding=True).print(f"Messages cleanup failed: {e}")
+            return False
+
+        # Swap the new summary in, unless the summarized messages are no longer in the history as one block
+        start = next((i for i, msg in enumerate(self.history) if msg is window[0]), -1)
+        end = start + len(window)
+        if start == -1 or end > len(self.history) or any(a is not b for a, b in zip(self.history[start:end], window)):
+            return False
+        if start > 0 and self.history[start-1] is self.summary_message: start -= 1
+
+        self.summaries = levels
+        self.summary_message = HumanMessage(content=self.render_summaries())
+        self.history = self.history[:start] + [self.summary_message] + self.history[end:]
+
+        PrintStyle(bold=True, font_color="orange", padding=True, background_color="white").print(f"{self.agent_name}: Mid messages cleanup summary:")
+        PrintStyle(italic=True, font_color="orange", padding=False).print(levels[0][-1] if levels[0] else self.summary_message.content)
+        return True
+
+    def is_over_history_limit(self):
+        return len(self.history) > self.msgs_keep_max or (self.msgs_keep_tokens > 0 and self.get_history_tokens() > self.msgs_keep_tokens)
+
+    async def enforce_history_limit(self):
+        # Hard limit, reached when background compaction failed, was cancelled or fell behind:
+        # wait for the running compaction, then compact synchronously, as a last resort drop the oldest messages.
+        while self.is_over_history_limit():
+            if self.cleanup_task:
+                task, self.cleanup_task = self.cleanup_task, None
+                await asyncio.wait([task]) # a failed or cancelled compaction is not raised here, it is redone below
+                continue
+
+            window = self.get_summary_window(self.msgs_keep_start, self.msgs_keep_end)
+            if not window: return # only kept messages left
+            if await self.compact_history(window): continue
+            length = len(self.history)
+            self.truncate_history(window)
+            if len(self.history) >= length: return # cannot shrink any further
+
+    def truncate_history(self, window):
+        # drop the window, right after the summary it just disappears, otherwise a placeholder keeps the message order
+        start = next((i for i, msg in enumerate(self.history) if msg is window[0]), -1)
+        if start == -1: return
+        end = start + len(window)
+        placeholder = [] if start > 0 and self.history[start-1] is self.summary_message else [HumanMessage(content=files.read_file("./prompts/fw.msg_truncated.md"))]
+        self.history = self.history[:start] + placeholder + self.history[end:]
+        PrintStyle(font_color="orange", padding=True).print(f"{self.agent_name}: {len(window)} messages dropped to stay within the history limit")
+
+    def render_summaries(self):
+        # oldest content first: higher levels cover earlier parts of the conversation
+        return "\n\n".join(summary for level in reversed(self.summaries) for summary in level)
+
+    async def handle_intervention(self, progress:str="") -> bool:
+        await self.control.wait_resumed() # wait if paused, without blocking other agents in the event loop
+        if not self.intervention_status: # if there is an intervention message, but not yet processed
+            intervention_message = self.control.pop_interventions(self.id) # take queued messages for this agent
+            if intervention_message:
+                if progress.strip(): await self.append_message(progress) # append the response generated so far
+                user_msg = files.read_file("./prompts/fw.intervention.md", user_message=intervention_message) # format the user intervention template
+                await self.append_message(user_msg,human=True) # append the intervention message
+                self.intervention_status = True
         return self.intervention_status # return intervention status
 
-    def process_tools(self, msg: str):
-        # search for tool usage requests in agent message
+    async def process_tools(self, msg: str):
+        # search for tool usage requests in agent message, there can be several in "tool_calls"
         tool_request = extract_tools.json_parse_dirty(msg)
-        tool_name = tool_request.get("tool_name", "")
-        tool_args = tool_request.get("tool_args", {})
-
-        tool = self.get_tool(
-                    tool_name,
-                    tool_args,
-                    msg)
-            
-        if self.handle_intervention(): return # wait if paused and handle intervention message if needed
-        
-        tool.before_execution(**tool_args)
-        response = tool.execute(**tool_args)
-        tool.after_execution(response)
-        if response.break_loop: return response.message
-
+        if isinstance(tool_request.get("tool_pipeline"), list):
+            return await self.process_pipeline(tool_request["tool_pipeline"], msg)
+
+        tool_requests = extract_tools.get_tool_requests(tool_request)
+        tools = [self.get_tool(
+                    request.get("tool_name", ""),
+                    request.get("tool_args", {}),
+                    msg) for request in tool_requests]
+
+        speculation = None
+        if len(tools) == 1: speculation = self.take_speculation(tools[0].name, tools[0].args) # result of an early start with identical args, if any
+        else: self.cancel_speculation()
+
+        # consecutive side-effect-free tools run concurrently, other tools run one by one in the given order
+        index = 0
+        while index < len(tools):
+            if await self.handle_intervention(): # wait if paused and handle intervention message if needed
+                if speculation: speculation.cancel()
+                return
+
+            group = [tools[index]]
+            while (group[0].is_side_effect_free() and len(group) < self.max_parallel_tools
+                    and index + len(group) < len(tools) and tools[index + len(group)].is_side_effect_free()):
+                group.append(tools[index + len(group)])
+            index += len(group)
+
+            for tool in group: await tool.before_execution(**tool.args)
+            responses = await asyncio.gather(
+                *(speculation if speculation else self.execute_tool(tool, **tool.args) for tool in group),
+                return_exceptions=True)
+
+            # responses are added to the history in request order, errors are forwarded after the results that succeeded
+            failures = []
+            for tool, response in zip(group, responses):
+                if isinstance(response, BaseException):
+                    failures.append((tool, response))
+                    continue
+                await tool.after_execution(response)
+                if response.break_loop: return response.message
+                self.record_call(tool, response.message)
+
+            if failures: # remaining tools are not run, the agent has to react to the errors first
+                error_message = "\n\n".join(f"{tool.name}: {errors.format_error(e)}" for tool, e in failures)
+                msg_response = files.read_file("./prompts/fw.error.md", error=error_message)
+                await self.append_message(msg_response, human=True)
+                PrintStyle(font_color="red", padding=True).print(msg_response)
+                return
+
+    async def process_pipeline(self, steps: list, msg: str):
+        # run a sequence of tool calls locally and report back once, stopping at the first failed step
+        self.cancel_speculation()
+        results = []
+        for number, step in enumerate(steps, start=1):
+            if await self.handle_intervention(): return # wait if paused and handle intervention message if needed
+            if not isinstance(step, dict): step = {}
+
+            tool = self.get_tool(
+                        step.get("tool_name", ""),
+                        pipeline.resolve_references(step.get("tool_args", {}), results),
+                        msg)
+            if type(tool) is self.get_tool_class("unknown"): # a misspelled or missing tool must not let the following steps run
+                await self.stop_pipeline(number, tool.name, f"tool '{tool.name}' not found", len(steps) - number)
+                return
+
+            await tool.before_execution(**tool.args)
+            try:
+                response = await self.execute_tool(tool, **tool.args)
+            except Exception as e:
+                await self.stop_pipeline(number, tool.name, errors.format_error(e), len(steps) - number)
+                return
+
+            await tool.after_execution(response)
+            if response.break_loop: return response.message
+            self.record_call(tool, response.message)
+            results.append(response.message)
+
+            reason = pipeline.get_failure(step, response.message, response.exit_code)
+            if reason:
+                await self.stop_pipeline(number, tool.name, reason, len(steps) - number)
+                return
+
+    def record_call(self, tool, result: str):
+        level = self.loop_detector.record(tool.name, tool.args, result)
+        self.loop_level = max(self.loop_level, level)
+
+    async def handle_loop(self):
+        # escalation: corrective hint, then a demand to change strategy, then the task is aborted with a report
+        level, self.loop_level = self.loop_level, loop_detector.NONE
+        if level == loop_detector.NONE: return
+        calls = self.loop_detector.get_report()
+
+        if level >= loop_detector.ABORT:
+            self.loop_detector.reset()
+            report = files.read_file("./prompts/fw.loop_abort.md", calls=calls)
+            PrintStyle(font_color="red", padding=True).print(report)
+            return report
+
+        prompt = "./prompts/fw.loop_warning.md" if level == loop_detector.CORRECT else "./prompts/fw.loop_switch_strategy.md"
+        warning_msg = files.read_file(prompt, calls=calls)
+        await self.append_message(warning_msg, human=True)
+        PrintStyle(font_color="orange", padding=True).print(warning_msg)
+
+    async def stop_pipeline(self, step: int, tool_name: str, reason: str, skipped: int):
+        msg_response = files.read_file("./prompts/fw.pipeline_stopped.md", step=step, tool_name=tool_name, reason=reason, skipped=skipped)
+        await self.append_message(msg_response, human=True)
+        PrintStyle(font_color="orange", padding=True).print(msg_response)
+
+    def start_speculation(self, parser: extract_tools.JsonStreamParser):
+        # start a side-effect-free tool as soon as its name and required args have streamed, ahead of the rest of the message
+        if not self.speculative_tools: return
+        if not self.speculation:
+            name = parser.get_value("tool_name")
+            if not name: return
+            self.speculation = {"name": name, "class": self.get_tool_class(name), "args": None, "task": None}
+        if self.speculation["args"] is not None: return # already started or rejected
+
+        keys = self.speculation["class"].speculative_args
+        args = {key: parser.get_value("tool_args", key) for key in keys}
+        if not keys or None in args.values(): return
+        self.speculation["args"] = args
+
+        tool = self.speculation["class"](agent=self, name=self.speculation["name"], args=args, message="")
+        if tool.is_side_effect_free():
+            self.speculation["task"] = asyncio.create_task(self.execute_tool(tool, **args))
+
+    def take_speculation(self, name: str, args: dict):
+        speculation, self.speculation = self.speculation, None
+        if not speculation or not speculation["task"]: return None
+        if speculation["name"] == name and speculation["args"] == args: return speculation["task"]
+        self.discard_task(speculation["task"]) # final args differ, result is useless
+        return None
+
+    def cancel_speculation(self):
+        if self.speculation and self.speculation["task"]: self.discard_task(self.speculation["task"])
+        self.speculation = None
+
+    def discard_task(self, task: asyncio.Task):
+        if task.done():
+            if not task.cancelled(): task.exception() # mark exception as retrieved
+        else: task.cancel()
 
     def get_tool(self, name: str, args: dict, message: str, **kwargs):
-        from tools.unknown import Unknown 
-        from tools.helpers.tool import Tool
-        
-        tool_class = Unknown
-        if files.exists("tools",f"{name}.py"): 
-            module = importlib.import_module("tools." + name)  # Import the module
-            class_list = inspect.getmembers(module, inspect.isclass)  # Get all functions in the module
-
-            for cls in class_list:
-                if cls[1] is not Tool and issubclass(cls[1], Tool):
-                    tool_class = cls[1]
-                    break
-
+        tool_class = self.get_tool_class(name)
         return tool_class(agent=self, name=name, args=args, message=message, **kwargs)
 
-    def fetch_memories(self,reset_skip=False):
+    def get_tool_class(self, name: str):
+        info = tool_registry.registry.get(name) or tool_registry.registry.get("unknown") # tools/unknown.py handles missing tools
+        return info.tool_class # type: ignore
+
+    async def execute_tool(self, tool, **kwargs):
+        # the registry applies per-tool timeout and concurrency limits, the task budget caps the wall time on top
+        seconds = self.budget.get_seconds_left() if self.budget else None
+        try:
+            async with asyncio.timeout(seconds) as deadline:
+                return await tool_registry.registry.execute(tool, **kwargs)
+        except TimeoutError:
+            if not deadline.expired(): raise # timeout of the tool itself
+            raise TimeoutError(f"{tool.name} stopped after {seconds:.0f} seconds, the time budget of the task ran out")
+
+    def prefetch_memories(self,reset_skip=False):
+        # start memory recall in the background, so it is off the critical path of the next LLM call
         if reset_skip: self.memory_skip_counter = 0
+        if self.memory_task and not self.memory_task.done(): return # previous recall still running
 
         if self.memory_skip_counter > 0:
             self.memory_skip_counter-=1
-            return ""
         else:
             self.memory_skip_counter = self.auto_memory_skip
-            from tools import memory_tool
-            messages = self.concat_messages(self.history)
-            memories = memory_tool.process_query(self,messages,"load")
-            input = {
-                "conversation_history" : messages,
-                "raw_memories": memories
-            }
-            cleanup_prompt = files.read_file("./prompts/msg.memory_cleanup.md").replace("{", "{{")       
-            clean_memories = self.send_adhoc_message(cleanup_prompt,json.dumps(input), output_label="Memory injection")
-            return clean_memories
\ No newline at end of file
+            self.memory_task = asyncio.create_task(self.fetch_memories())
+
+    async def get_memories(self):
+        # use what the prefetch produced within the deadline, otherwise keep the current block and pick it up next turn
+        task = self.memory_task
+        if not task: return self.memories
+        if not task.done():
+            try: await asyncio.wait_for(asyncio.shield(task), self.memory_prefetch_timeout)
+            except Exception: pass # timeout or failure, handled below
+            if not task.done(): return self.memories
+
+        self.memory_task = None
+        if task.cancelled(): return self.memories
+        if task.exception():
+            PrintStyle(font_color="red", padding=True).print(f"Memory recall failed: {task.exception()}")
+            return self.memories
+
+        memories, self.memory_vector, self.memory_version = task.result()
+        if memories is self.memories: return self.memories # topic did not move, block reused
+        self.memories = memories
+        PrintStyle(bold=True, font_color="orange", padding=True, background_color="white").print(f"{self.agent_name}: Memory injection:")
+        PrintStyle(italic=True, font_color="orange", padding=False).print(self.memories)
+        return self.memories
+
+    async def fetch_memories(self):
+        # returns the memory block with the recall vector and database version it was retrieved with
+        from tools import memory_tool
+        vector, query = await asyncio.to_thread(memory_tool.get_recall_query, self, self.auto_memory_window, self.auto_memory_decay) # embedding runs off the event loop
+        version = memory_tool.get_version(self)
+        if vector is None: return self.memories, self.memory_vector, self.memory_version
+        if (self.memory_vector is not None and version == self.memory_version
+                and memory_tool.get_drift(vector, self.memory_vector) < self.auto_memory_drift):
+            return self.memories, self.memory_vector, self.memory_version # same topic and no new memories, keep the current block
+
+        memories = await asyncio.to_thread(memory_tool.recall, self, vector, query, self.auto_memory_count, self.auto_memory_threshold) # vector search and reranking
+        if not memories: return "", vector, version
+        if not self.auto_memory_summarize: return files.read_file("./prompts/agent.memory.md", memories="\n\n".join(memories)), vector, version
+
+        messages = self.concat_messages(self.history[-self.auto_memory_window:])
+        input = {
+            "conversation_history" : messages,
+            "raw_memories": memories
+        }
+        cleanup_prompt = files.read_file("./prompts/msg.memory_cleanup.md")
+        clean_memories = await self.send_adhoc_message(cleanup_prompt,json.dumps(input), output_label="", background=True) # printed when picked up
+        return clean_memories, vector, version
\ No newline at end of file
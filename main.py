@@ -1,19 +1,17 @@
-import threading, sys, time, readline, models, os
+import threading, sys, time, readline, models, os, select
 from ansio import application_keypad, mouse_input, raw_input
 from ansio.input import InputEvent, get_input_event
 from agent import Agent
 from tools.helpers.print_style import PrintStyle
 from tools.helpers.files import read_file
 from pytimedinput import timedInput as timed_input
-from tools.helpers import files
+from tools.helpers import files, tool_registry, control
 
 
 input_lock = threading.Lock()
 
-os.chdir(files.get_abs_path("./work_dir")) #change CWD to work_dir
-
 # Main conversation loop
-def chat():
+def chat(session: control.Control):
 
     # chat model used for agents
     # chat_llm = models.get_groq_llama70b(temperature=0.2)
@@ -33,9 +31,12 @@ def chat():
     
     # create the first agent
     agent0 = Agent( agent_number=0,
+                    control=session,
                     chat_model=chat_llm,
                     embeddings_model=embedding_llm,
                     # memory_subdir = "",
+                    # memory_backend = "chroma",
+                    # memory_persist_queries = False,
                     # auto_memory_count = 3,
                     # auto_memory_skip = 2,
                     # rate_limit_seconds = 60,
@@ -46,6 +47,13 @@ def chat():
                     # msgs_keep_start = 5,
                     # msgs_keep_end = 10,
                     # max_tool_response_length = 3000,
+                    # work_dir = "work_dir",
+                    # work_dir_tmpfs = False,
+                    # loop_window = 8,
+                    # loop_threshold = 2,
+                    # budget_seconds = 0,
+                    # budget_calls = 0,
+                    # budget_cost = 0,
                    )
 
     # start the conversation loop  
@@ -85,9 +93,10 @@ def chat():
                         
 
 # User intervention during agent streaming
-def intervention():
-    if Agent.streaming_agent and not Agent.paused:
-        Agent.paused = True # stop agent streaming
+def intervention(session: control.Control):
+    agent = session.streaming_agent
+    if agent and not session.paused:
+        session.pause() # stop agent streaming
         PrintStyle(background_color="#6C3483", font_color="white", bold=True, padding=True).print(f"User intervention ('exit' to leave, empty to continue):")        
 
         import readline
@@ -95,32 +104,48 @@ def intervention():
         PrintStyle(font_color="white", padding=False, log_only=True).print(f"> {user_input}")        
         
         if user_input.lower() == 'exit': os._exit(0) # exit the conversation when the user types 'exit'
-        if user_input: Agent.streaming_agent.intervention_message = user_input # set intervention message if non-empty
-        Agent.paused = False # continue agent streaming 
+        if user_input: session.intervene(user_input, agent.id) # queue intervention message if non-empty
+        session.resume() # continue agent streaming 
     
 
 # Capture keyboard input to trigger user intervention
-def capture_keys():
+def capture_keys(session: control.Control):
         global input_lock
-        intervent=False            
         while True:
-            if intervent: intervention()
+            session.streaming.wait() # sleep until an agent starts streaming
             intervent = False
-            time.sleep(0.1)
-            
-            if Agent.streaming_agent:
-                # with raw_input, application_keypad, mouse_input:
-                with input_lock, raw_input, application_keypad:
+
+            with input_lock, raw_input, application_keypad:
+                session.drain_wake()
+                while session.streaming.is_set():
+                    # sleep until a key is pressed or streaming stops
+                    readable, _, _ = select.select([sys.stdin, session.wake_read], [], [])
+                    if session.wake_read in readable:
+                        session.drain_wake()
+                        continue
                     event: InputEvent | None = get_input_event(timeout=0.1)
                     if event and (event.shortcut.isalpha() or event.shortcut.isspace()):
-                        intervent=True
-                        continue
+                        intervent = True
+                        break
+
+            if intervent: intervention(session)
 
 if __name__ == "__main__":
     print("Initializing framework...")
 
+    # Discover tools once, set hot_reload to pick up edited tool files without restarting
+    tool_registry.registry.load()
+    # tool_registry.registry.hot_reload = True
+
+    # Parse prompt templates once, edited files are reloaded on change
+    files.preload_templates()
+
+    # Control state of this terminal session, shared by the agents and the key capture thread
+    session = control.create_session()
+
     # Start the key capture thread for user intervention during agent streaming
-    threading.Thread(target=capture_keys, daemon=True).start()
+    threading.Thread(target=capture_keys, args=(session,), daemon=True).start()
 
     # Start the chat
-    chat()
\ No newline at end of file
+    chat(session)
+    control.close_session(session.id)
\ No newline at end of file
@@ -1,5 +1,6 @@
 import os
 from dotenv import load_dotenv
+from langchain_core.messages import BaseMessage
 from langchain_community.llms import Ollama
 from langchain_openai import ChatOpenAI, OpenAI, OpenAIEmbeddings
 from langchain_anthropic import ChatAnthropic
@@ -37,7 +38,7 @@ def get_anthropic_opus(api_key=None, temperature=DEFAULT_TEMPERATURE):
 
 def get_openai_gpt35(api_key=None, temperature=DEFAULT_TEMPERATURE):
     api_key = api_key or get_api_key("openai")
-    return ChatOpenAI(model_name="gpt-3.5-turbo", temperature=temperature, api_key=api_key) # type: ignore
+    return ChatOpenAI(model_name="gpt-3.5-turbo", temperature=temperature, api_key=api_key, stream_usage=True) # type: ignore
 
 def get_openai_gpt35_instruct(api_key=None, temperature=DEFAULT_TEMPERATURE):
     api_key = api_key or get_api_key("openai")
@@ -45,11 +46,11 @@ def get_openai_gpt35_instruct(api_key=None, temperature=DEFAULT_TEMPERATURE):
 
 def get_openai_gpt4(api_key=None, temperature=DEFAULT_TEMPERATURE):
     api_key = api_key or get_api_key("openai")
-    return ChatOpenAI(model_name="gpt-4-0125-preview", temperature=temperature, api_key=api_key) # type: ignore
+    return ChatOpenAI(model_name="gpt-4-0125-preview", temperature=temperature, api_key=api_key, stream_usage=True) # type: ignore
 
 def get_openai_gpt4o(api_key=None, temperature=DEFAULT_TEMPERATURE):
     api_key = api_key or get_api_key("openai")
-    return ChatOpenAI(model_name="gpt-4o", temperature=temperature, api_key=api_key) # type: ignore
+    return ChatOpenAI(model_name="gpt-4o", temperature=temperature, api_key=api_key, stream_usage=True) # type: ignore
 
 def get_groq_mixtral7b(api_key=None, temperature=DEFAULT_TEMPERATURE):
     api_key = api_key or get_api_key("groq")
@@ -78,6 +79,101 @@ def get_ollama_dolphin(api_key=None, temperature=DEFAULT_TEMPERATURE):
 def get_ollama_phi(api_key=None, temperature=DEFAULT_TEMPERATURE):
     return Ollama(model="phi3:3.8b-mini-instruct-4k-fp16",temperature=temperature)
 
+def get_cache_control(chat_model):
+    # providers that accept explicit prompt cache breakpoints on content blocks
+    if isinstance(chat_model, ChatAnthropic): return {"type": "ephemeral"}
+    return None
+
+# Tokenizers used for token accounting, selected by model type
+class Tokenizer:
+    def count(self, text: str) -> int:
+        return int(len(text)/4) # rough estimate, used when no real tokenizer is available
+
+class TiktokenTokenizer(Tokenizer):
+    def __init__(self, model_name: str):
+        import tiktoken
+        try: self.encoding = tiktoken.encoding_for_model(model_name)
+        except KeyError: self.encoding = tiktoken.get_encoding("cl100k_base")
+
+    def count(self, text: str) -> int:
+        return len(self.encoding.encode(text, disallowed_special=()))
+
+class ModelTokenizer(Tokenizer):
+    # uses the langchain model's own get_num_tokens (Anthropic client tokenizer, GPT-2 fallback for others)
+    def __init__(self, model):
+        self.model = model
+
+    def count(self, text: str) -> int:
+        try: return self.model.get_num_tokens(text)
+        except Exception: return super().count(text)
+
+tokenizer_factories = [
+    ((ChatOpenAI, OpenAI), lambda model: TiktokenTokenizer(model.model_name)),
+]
+
+def register_tokenizer(model_types, factory):
+    tokenizer_factories.insert(0, (model_types, factory))
+
+def get_tokenizer(model) -> Tokenizer:
+    for model_types, factory in tokenizer_factories:
+        if isinstance(model, model_types):
+            try: return factory(model)
+            except Exception: break
+    if hasattr(model, "get_num_tokens"): return ModelTokenizer(model)
+    return Tokenizer()
+
+def count_message_tokens(message: BaseMessage, tokenizer: Tokenizer) -> int:
+    # token count is stored on the message and only recomputed when its content changes
+    meta = message.response_metadata
+    content = str(message.content)
+    content_hash = hash(content) # edits of the same length change the hash too
+    if meta.get("token_count_hash") != content_hash:
+        meta["token_count"] = tokenizer.count(content)
+        meta["token_count_hash"] = content_hash
+    return meta["token_count"]
+
+def add_usage(usage: dict, chunk) -> dict:
+    # sum exact token usage reported by the provider in streamed chunks (usage_metadata)
+    chunk_usage = getattr(chunk, "usage_metadata", None)
+    if chunk_usage:
+        for key in ("input_tokens", "output_tokens"):
+            if key in chunk_usage: usage[key] = usage.get(key, 0) + chunk_usage[key]
+    return usage
+
+def get_reported_usage(usage: dict, complete: bool) -> tuple[int | None, int | None]:
+    # input tokens are final as soon as they are reported, Anthropic sends them up front in message_start,
+    # so they are kept from a stream closed early; output tokens are only final when the stream was read to the end
+    # (message_start reports 1 output token). Providers that report usage only in the last chunk (OpenAI)
+    # give nothing for a stream closed early. None keeps the estimate.
+    input_tokens = usage.get("input_tokens") or None # a partial stream may only have seen deltas reporting 0
+    return input_tokens, usage.get("output_tokens") if complete else None
+
+# USD per million input and output tokens, used for cost budgets, unknown models count as free
+prices = {
+    "claude-3-haiku-20240307": (0.25, 1.25),
+    "claude-3-5-sonnet-20240620": (3.0, 15.0),
+    "claude-3-sonnet-20240229": (3.0, 15.0),
+    "claude-3-opus-20240229": (15.0, 75.0),
+    "gpt-3.5-turbo": (0.5, 1.5),
+    "gpt-3.5-turbo-instruct": (1.5, 2.0),
+    "gpt-4-0125-preview": (10.0, 30.0),
+    "gpt-4o": (5.0, 15.0),
+    "mixtral-8x7b-32768": (0.24, 0.24),
+    "llama3-70b-8192": (0.59, 0.79),
+    "Llama3-8b-8192": (0.05, 0.08),
+    "gemma-7b-it": (0.07, 0.07),
+}
+
+def get_model_name(model) -> str:
+    return str(getattr(model, "model_name", None) or getattr(model, "model", ""))
+
+def get_cost(model, input_tokens: int, output_tokens: int) -> float | None:
+    # None when the model has no entry in prices, its cost is unknown
+    price = prices.get(get_model_name(model))
+    if price is None: return None
+    input_price, output_price = price
+    return (input_tokens * input_price + output_tokens * output_price) / 1_000_000
+
 def get_embedding_hf(model_name="sentence-transformers/all-MiniLM-L6-v2"):
     return HuggingFaceEmbeddings(model_name=model_name)
 
@@ -0,0 +1,71 @@
+import os, sys, unittest
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from tools.helpers import loop_detector
+from tools.helpers.loop_detector import LoopDetector
+
+def terminal(code: str) -> dict:
+    return {"runtime": "terminal", "code": code}
+
+class TestLoopDetector(unittest.TestCase):
+
+    def record_all(self, detector: LoopDetector, calls: list) -> list[int]:
+        return [detector.record("code_execution_tool", args, result) for args, result in calls]
+
+    def test_distinct_short_commands_are_not_repeats(self):
+        detector = LoopDetector(threshold=1)
+        commands = ["ls", "pwd", "whoami", "id", "df", "du", "env", "date"]
+        levels = self.record_all(detector, [(terminal(command), "ok") for command in commands])
+        self.assertEqual(levels, [loop_detector.NONE] * len(commands))
+        self.assertEqual(detector.repeats, 0)
+
+    def test_distinct_short_results_are_not_repeats(self):
+        detector = LoopDetector(threshold=1)
+        levels = self.record_all(detector, [(terminal("cat state"), "ok"), (terminal("cat state"), "no")])
+        self.assertEqual(levels, [loop_detector.NONE, loop_detector.NONE])
+
+    def test_exact_repeats_escalate(self):
+        detector = LoopDetector(threshold=2)
+        levels = self.record_all(detector, [(terminal("false"), "failed")] * 7)
+        self.assertEqual(levels, [loop_detector.NONE, loop_detector.NONE, loop_detector.CORRECT, loop_detector.NONE,
+                                  loop_detector.SWITCH_STRATEGY, loop_detector.NONE, loop_detector.ABORT])
+        self.assertIn("false", detector.get_report())
+
+    def test_arg_order_and_result_whitespace_and_numbers_are_ignored(self):
+        detector = LoopDetector(threshold=1)
+        detector.record("Code_Execution_Tool", {"runtime": "terminal", "code": "make"}, "Build failed at 12:01:07")
+        level = detector.record("code_execution_tool", {"code": "make", "runtime": "terminal"}, "build  failed at 12:01:09\n")
+        self.assertEqual(level, loop_detector.CORRECT)
+
+    def test_whitespace_in_args_is_ignored(self):
+        detector = LoopDetector(threshold=1)
+        detector.record("code_execution_tool", terminal("ls  -la"), "total 0")
+        level = detector.record("code_execution_tool", terminal("ls -la\n"), "total 0")
+        self.assertEqual(level, loop_detector.CORRECT)
+
+    def test_case_in_args_is_kept(self):
+        detector = LoopDetector(threshold=1)
+        levels = self.record_all(detector, [(terminal("cat README"), "missing"), (terminal("cat readme"), "missing")])
+        self.assertEqual(levels, [loop_detector.NONE, loop_detector.NONE])
+
+    def test_different_args_are_not_repeats(self):
+        detector = LoopDetector(threshold=1)
+        output = "error: file not found " * 20
+        levels = self.record_all(detector, [(terminal("cat a.txt"), output), (terminal("cat b.txt"), output)])
+        self.assertEqual(levels, [loop_detector.NONE, loop_detector.NONE])
+
+    def test_long_results_match_near_duplicates(self):
+        detector = LoopDetector(threshold=1)
+        words = " ".join(f"line{chr(97 + i % 26)} status pending" for i in range(40))
+        detector.record("code_execution_tool", terminal("make"), words + " done")
+        level = detector.record("code_execution_tool", terminal("make"), words + " finished")
+        self.assertEqual(level, loop_detector.CORRECT)
+
+    def test_reset(self):
+        detector = LoopDetector(threshold=1)
+        detector.record("code_execution_tool", terminal("false"), "failed")
+        detector.reset()
+        self.assertEqual(detector.record("code_execution_tool", terminal("false"), "failed"), loop_detector.NONE)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,18 +1,87 @@
+import asyncio, os
 from agent import Agent
 from tools.helpers.tool import Tool, Response
-from tools.helpers import files
+from tools.helpers import files, agent_pool
 from tools.helpers.print_style import PrintStyle
 
 class Delegation(Tool):
 
-    def execute(self, message="", reset="", **kwargs):
-        # create subordinate agent using the data object on this agent and set superior agent to his data object
-        if self.agent.get_data("subordinate") is None or str(reset).lower().strip() == "true":
-            # subordinate = Agent(system_prompt=self.agent.system_prompt, tools_prompt=self.agent.tools_prompt, number=self.agent.number+1)
-            config = self.agent.__dict__.copy()
-            config["agent_number"] = self.agent.agent_number+1
-            subordinate = Agent(**config)
-            subordinate.set_data("superior", self.agent)
+    async def execute(self, message="", reset="", messages=None, join="all", timeout="", **kwargs):
+        if isinstance(messages, list) and messages:
+            try: seconds = float(timeout) if str(timeout).strip() else None
+            except ValueError: seconds = -1
+            if seconds is not None and not seconds > 0:
+                return Response( message=f"Invalid timeout \"{timeout}\", use a positive number of seconds or leave it empty.", break_loop=False)
+            return Response( message=await self.fan_out([str(msg) for msg in messages], str(join), seconds), break_loop=False)
+
+        # take subordinate agent from the pool, it gets this agent as superior in its data object
+        pool = agent_pool.get_pool(self.agent.control)
+        subordinate = self.agent.get_data("subordinate")
+        if subordinate is None or str(reset).lower().strip() == "true":
+            if subordinate: pool.release(subordinate) # frees the previous subordinate and its whole subtree
+            subordinate = pool.acquire(self.agent)
             self.agent.set_data("subordinate", subordinate) 
-        # run subordinate agent message loop
-        return Response( message=self.agent.get_data("subordinate").message_loop(message), break_loop=False)
\ No newline at end of file
+        share = self.agent.budget.split(1)[0] if self.agent.budget else None
+        subordinate.set_data("budget", share)
+        # run subordinate agent message loop, it cannot outlive its share of the time budget
+        seconds = share.get_seconds_left() if share else None
+        try:
+            async with asyncio.timeout(seconds) as deadline:
+                return Response( message=await subordinate.amessage_loop(message), break_loop=False)
+        except TimeoutError:
+            if not deadline.expired(): raise
+            return Response( message=f"Subordinate timed out after {seconds:.0f} seconds, its time budget ran out.", break_loop=False)
+
+    async def fan_out(self, messages: list[str], join: str, timeout: float | None):
+        # run one fresh subordinate per message in parallel, each with its own history, work directory and memory
+        pool = agent_pool.get_pool(self.agent.control)
+        subordinates = []
+        budgets = self.agent.budget.split(len(messages)) if self.agent.budget else [None] * len(messages)
+        try:
+            for i in range(len(messages)):
+                subordinate = pool.acquire(self.agent)
+                subordinates.append(subordinate)
+                subordinate.set_data("budget", budgets[i])
+                work_dir = os.path.join(self.agent.get_work_dir(), f"agent{subordinate.agent_number}_task{i+1}")
+                os.makedirs(work_dir, exist_ok=True)
+                subordinate.set_data("work_dir", work_dir)
+                subordinate.set_data("memory_isolated", True)
+            self.agent.set_data("subordinates", subordinates)
+
+            deadline = timeout
+            seconds = budgets[0].get_seconds_left() if budgets[0] else None
+            if seconds is not None: deadline = min(deadline, seconds) if deadline is not None else seconds # never outlive the superior's time budget
+            tasks = [asyncio.create_task(self.run_subordinate(sub, msg, deadline)) for sub, msg in zip(subordinates, messages)]
+            results = [f"cancelled, not needed for join \"{join}\"" for _ in tasks]
+            needed = get_join_count(join, len(tasks))
+
+            # collect results until the join policy is satisfied, the rest is cancelled
+            successes = 0
+            pending = set(tasks)
+            while pending and successes < needed:
+                done, pending = await asyncio.wait(pending, return_when=asyncio.FIRST_COMPLETED)
+                for task in done:
+                    success, results[tasks.index(task)] = task.result()
+                    if success: successes += 1
+            for task in pending: task.cancel() # running code execution is killed with its process group, see code_execution_tool.kill_process
+            await asyncio.gather(*pending, return_exceptions=True)
+
+            return "\n\n".join(f"# Subordinate {i+1}:\n{result}" for i, result in enumerate(results))
+        finally:
+            self.agent.set_data("subordinates", None)
+            for subordinate in subordinates: pool.release(subordinate)
+
+    async def run_subordinate(self, subordinate: Agent, message: str, timeout: float | None):
+        try:
+            return True, await asyncio.wait_for(subordinate.amessage_loop(message), timeout)
+        except asyncio.TimeoutError:
+            return False, f"timed out after {timeout} seconds"
+        except Exception as e:
+            return False, f"failed: {e}"
+
+def get_join_count(join: str, count: int) -> int:
+    # "all" waits for every subordinate, "first_success" for one successful, a number k for the first k successful
+    join = join.lower().strip()
+    if join == "first_success": return 1
+    if join.isdigit(): return max(1, min(int(join), count))
+    return count
\ No newline at end of file
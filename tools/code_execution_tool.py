@@ -1,4 +1,4 @@
-import os, json, contextlib, subprocess, ast, shlex
+import os, json, contextlib, subprocess, ast, shlex, asyncio, signal
 from io import StringIO
 from tools.helpers import files, messages
 from agent import Agent
@@ -8,31 +8,45 @@ from tools.helpers.print_style import PrintStyle
 
 class CodeExecution(Tool):
 
-    def execute(self,**kwargs):
+    async def execute(self,**kwargs):
 
-        # os.chdir(files.get_abs_path("./work_dir")) #change CWD to work_dir
-        
         runtime = self.args["runtime"].lower().strip()
+        exit_code = None
         if runtime == "python":
-            response = self.execute_python_code(self.args["code"])
+            response, exit_code = await self.execute_python_code(self.args["code"])
         elif runtime == "nodejs":
-            response = self.execute_nodejs_code(self.args["code"])
+            response, exit_code = await self.execute_nodejs_code(self.args["code"])
         elif runtime == "terminal":
-            response = self.execute_terminal_command(self.args["code"])
+            response, exit_code = await self.execute_terminal_command(self.args["code"])
         else:
             response = files.read_file("./prompts/fw.code_runtime_wrong.md", runtime=runtime)
 
         if not response: response = files.read_file("./prompts/fw.code_no_output.md")
-        return Response(message=response, break_loop=False)
+        if exit_code: response += "\n" + files.read_file("./prompts/fw.code_exit_code.md", exit_code=exit_code)
+        return Response(message=response, break_loop=False, exit_code=exit_code)
 
-    def execute_python_code(self, code, input_data="y\n"):
-        result = subprocess.run(['python', '-c', code], capture_output=True, text=True, input=input_data)
-        return result.stdout + result.stderr
+    async def execute_python_code(self, code, input_data="y\n"):
+        process = await asyncio.create_subprocess_exec('python', '-c', code, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=self.agent.get_work_dir(), start_new_session=True)
+        return await self.communicate(process, input_data)
 
-    def execute_nodejs_code(self, code, input_data="y\n"):
-        result = subprocess.run(['node', '-e', code], capture_output=True, text=True, input=input_data)
-        return result.stdout + result.stderr
+    async def execute_nodejs_code(self, code, input_data="y\n"):
+        process = await asyncio.create_subprocess_exec('node', '-e', code, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=self.agent.get_work_dir(), start_new_session=True)
+        return await self.communicate(process, input_data)
 
-    def execute_terminal_command(self, command, input_data="y\n"):
-        result = subprocess.run(command, shell=True, capture_output=True, text=True, input=input_data)
-        return result.stdout + result.stderr
\ No newline at end of file
+    async def execute_terminal_command(self, command, input_data="y\n"):
+        process = await asyncio.create_subprocess_shell(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=self.agent.get_work_dir(), start_new_session=True)
+        return await self.communicate(process, input_data)
+
+    async def communicate(self, process, input_data) -> tuple[str, int]:
+        # combined output and exit status
+        try:
+            stdout, stderr = await process.communicate(input_data.encode()) # the event loop keeps serving other agents while the process runs
+        except BaseException: # timed out or cancelled, the process must not outlive the tool
+            kill_process(process)
+            raise
+        return stdout.decode(errors="replace") + stderr.decode(errors="replace"), process.returncode
+
+def kill_process(process):
+    # the process runs in its own session, so the whole group is killed, including children of a shell
+    try: os.killpg(process.pid, signal.SIGKILL)
+    except (ProcessLookupError, PermissionError): pass
\ No newline at end of file
@@ -0,0 +1,65 @@
+from agent import Agent
+
+class AgentPool:
+    # Subordinate agents are handed out from here instead of being constructed for every delegation.
+    # Released agents are reset and kept for reuse with the same config, the number of live agents is capped.
+
+    def __init__(self, max_live: int = 20, max_idle: int = 5):
+        self.max_live = max_live
+        self.max_idle = max_idle # idle agents kept per config, the rest is dropped
+        self.idle: dict[tuple, list[Agent]] = {}
+        self.live: dict[int, Agent] = {}
+
+    def acquire(self, superior: Agent) -> Agent:
+        if len(self.live) >= self.max_live:
+            raise RuntimeError(f"Too many subordinate agents running ({self.max_live}). Reuse existing subordinates or finish their tasks first.")
+
+        config = superior.get_config()
+        config["agent_number"] = superior.agent_number + 1
+        key = get_config_key(config)
+        idle = self.idle.get(key)
+        agent = idle.pop() if idle else Agent(**config)
+        if idle == []: del self.idle[key]
+
+        self.live[id(agent)] = agent
+        if agent.control.get_agent(agent.id) is not agent: agent.id = agent.control.register(agent) # registered again after an idle time
+        agent.set_data("superior", superior)
+        for field in ("work_dir", "memory_isolated"): # the whole subtree of a fan-out child stays in its directory and memory
+            agent.set_data(field, superior.get_data(field))
+        agent.rate_limiter = superior.rate_limiter # the whole tree calls the same provider account
+        return agent
+
+    def release(self, agent: Agent):
+        # release the agent together with its whole subtree of subordinates
+        for subordinate in [agent.get_data("subordinate")] + (agent.get_data("subordinates") or []):
+            if subordinate: self.release(subordinate)
+        if self.live.pop(id(agent), None) is None: return # not from this pool or already released
+
+        agent.reset()
+        agent.control.unregister(agent.id) # idle or dropped, the session no longer addresses it
+        idle = self.idle.setdefault(get_config_key(agent.get_config()), [])
+        if len(idle) < self.max_idle: idle.append(agent)
+
+class Identity:
+    # hashable reference to a config object (model, session), compared by identity;
+    # the key keeps the object alive, so its id cannot be reused by another object while the key exists
+    def __init__(self, value):
+        self.value = value
+
+    def __hash__(self):
+        return id(self.value)
+
+    def __eq__(self, other):
+        return isinstance(other, Identity) and other.value is self.value
+
+def get_config_key(config: dict) -> tuple:
+    def key(value):
+        if isinstance(value, (str, int, float, bool, type(None))): return value
+        if isinstance(value, (list, tuple)): return tuple(key(val) for val in value)
+        return Identity(value)
+    return tuple(sorted((name, key(value)) for name, value in config.items()))
+
+def get_pool(session) -> AgentPool:
+    # each session has its own pool, subordinates of one session do not count against the limits of another
+    if session.pool is None: session.pool = AgentPool()
+    return session.pool
@@ -0,0 +1,78 @@
+import time
+
+class Budget:
+    # Limits for one task: wall time, LLM calls, input/output tokens and estimated cost (USD), 0 means unlimited.
+    # Budgets form a tree, spending is charged to the budget and all its ancestors,
+    # so a subordinate stops when either its own share or any budget above it runs out.
+
+    def __init__(self, seconds: float = 0, calls: int = 0, input_tokens: int = 0, output_tokens: int = 0, cost: float = 0, parent: "Budget | None" = None):
+        self.seconds = seconds
+        self.calls = calls
+        self.input_tokens = input_tokens
+        self.output_tokens = output_tokens
+        self.cost = cost
+        self.parent = parent
+        self.started = time.time()
+        self.spent = {"calls": 0, "input_tokens": 0, "output_tokens": 0, "cost": 0.0}
+
+    def charge(self, input_tokens: int, output_tokens: int, cost: float):
+        budget = self
+        while budget:
+            budget.spent["calls"] += 1
+            budget.spent["input_tokens"] += input_tokens
+            budget.spent["output_tokens"] += output_tokens
+            budget.spent["cost"] += cost
+            budget = budget.parent
+
+    def get_remaining(self) -> dict:
+        # what is left of each limit, None for unlimited
+        limits = {"seconds": self.seconds, "calls": self.calls, "input_tokens": self.input_tokens, "output_tokens": self.output_tokens, "cost": self.cost}
+        spent = dict(self.spent, seconds=time.time() - self.started)
+        return {name: max(limit - spent[name], 0) if limit else None for name, limit in limits.items()}
+
+    def get_seconds_left(self) -> float | None:
+        # wall time left before this budget or one of its ancestors runs out, None without any time limit
+        left = None
+        budget = self
+        while budget:
+            seconds = budget.get_remaining()["seconds"]
+            if seconds is not None: left = seconds if left is None else min(left, seconds)
+            budget = budget.parent
+        return left
+
+    def has_cost_limit(self) -> bool:
+        budget = self
+        while budget:
+            if budget.cost: return True
+            budget = budget.parent
+        return False
+
+    def get_exceeded(self, next_input_tokens: int = 0) -> str:
+        # reason why the next LLM call would not fit into this budget or one of its ancestors, empty if it fits
+        budget = self
+        while budget:
+            remaining = budget.get_remaining()
+            if remaining["seconds"] == 0: return f"time limit of {budget.seconds:.0f} seconds reached"
+            if remaining["calls"] == 0: return f"limit of {budget.calls} LLM calls reached"
+            if remaining["input_tokens"] is not None and remaining["input_tokens"] < max(next_input_tokens, 1):
+                return f"input token limit of {budget.input_tokens} reached"
+            if remaining["output_tokens"] == 0: return f"output token limit of {budget.output_tokens} reached"
+            if remaining["cost"] == 0: return f"cost limit of ${budget.cost:.4g} reached"
+            budget = budget.parent
+        return ""
+
+    def split(self, count: int, reserve: float = 0.1) -> list["Budget"]:
+        # child budgets for `count` subordinates running in parallel, each gets an equal share of what is left
+        # after a reserve the superior keeps to finish its own work, time is not divided since they run concurrently
+        remaining = self.get_remaining()
+        share = (1 - reserve) / max(count, 1)
+        def part(name, whole=False):
+            value = remaining[name]
+            if value is None: return 0
+            return value * (1 - reserve) if whole else value * share
+        return [Budget(seconds=part("seconds", whole=True),
+                       calls=max(int(part("calls")), 1) if self.calls else 0,
+                       input_tokens=max(int(part("input_tokens")), 1) if self.input_tokens else 0,
+                       output_tokens=max(int(part("output_tokens")), 1) if self.output_tokens else 0,
+                       cost=part("cost"),
+                       parent=self) for _ in range(count)]
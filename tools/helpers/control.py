@@ -0,0 +1,130 @@
+import asyncio, os, threading, itertools, uuid, weakref
+from collections import deque
+
+class Control:
+    # Control state of one session (one agent tree): pause/resume, current streamer and queued user interventions.
+    # Changes are delivered through events and a wake-up pipe, nobody has to poll.
+
+    def __init__(self, session_id: str = ""):
+        self.id = session_id or uuid.uuid4().hex
+        self.agents: dict[str, object] = {} # agents of this session by agent id
+        self.interventions: dict[str, deque] = {} # queued user messages by agent id
+        self.agent_ids = itertools.count()
+        self.resumed = threading.Event()
+        self.resumed.set()
+        self.resumed_events = weakref.WeakKeyDictionary() # asyncio copy of `resumed` for each event loop waiting on it
+        self.lock = threading.Lock()
+        self.streaming = threading.Event()
+        self.streaming_agent = None
+        self.pool = None # subordinate agent pool of this session, see agent_pool.get_pool
+        self.closed = False
+        self.wake_read, self.wake_write = os.pipe() # wakes up select() of the keyboard reader when streaming stops
+        os.set_blocking(self.wake_read, False)
+        os.set_blocking(self.wake_write, False)
+
+    @property
+    def paused(self) -> bool:
+        return not self.resumed.is_set()
+
+    def pause(self):
+        with self.lock:
+            self.resumed.clear()
+            self.notify_loops("clear")
+
+    def resume(self):
+        with self.lock:
+            self.resumed.set()
+            self.notify_loops("set")
+
+    def notify_loops(self, method: str):
+        # asyncio events are not thread safe, they are changed from inside their own loop
+        for loop, event in list(self.resumed_events.items()):
+            try: loop.call_soon_threadsafe(getattr(event, method))
+            except RuntimeError: self.resumed_events.pop(loop, None) # loop is closed
+
+    def set_streaming(self, agent):
+        self.streaming_agent = agent
+        self.streaming.set()
+
+    def clear_streaming(self, agent):
+        # only the current owner can clear, parallel agents of the session do not unset each other
+        if self.streaming_agent is not agent: return
+        self.streaming_agent = None
+        self.streaming.clear()
+        self.wake()
+
+    def wake(self):
+        if self.closed: return
+        try: os.write(self.wake_write, b"\0")
+        except BlockingIOError: pass # pipe is full, reader is awake anyway
+
+    def drain_wake(self):
+        if self.closed: return
+        try:
+            while os.read(self.wake_read, 1024): pass
+        except BlockingIOError: pass
+
+    def close(self):
+        # drop the agents and the pool, close the wake-up pipe, the session cannot be used afterwards
+        if self.closed: return
+        self.closed = True
+        self.resume() # nobody stays paused on a closed session
+        self.agents.clear()
+        self.interventions.clear()
+        self.pool = None
+        self.streaming_agent = None
+        for fd in (self.wake_read, self.wake_write): os.close(fd)
+
+    def register(self, agent) -> str:
+        agent_id = str(next(self.agent_ids))
+        self.agents[agent_id] = agent
+        return agent_id
+
+    def unregister(self, agent_id: str):
+        self.agents.pop(agent_id, None)
+        self.interventions.pop(agent_id, None)
+
+    def get_agent(self, agent_id: str):
+        return self.agents.get(agent_id)
+
+    def intervene(self, message: str, agent_id: str = "") -> bool:
+        # queue a user message for the given agent, or for the one currently streaming
+        if not agent_id and self.streaming_agent: agent_id = self.streaming_agent.id # type: ignore
+        if agent_id not in self.agents: return False
+        self.interventions.setdefault(agent_id, deque()).append(message)
+        return True
+
+    def pop_interventions(self, agent_id: str) -> str:
+        queue = self.interventions.get(agent_id)
+        messages = []
+        while queue:
+            messages.append(queue.popleft())
+        return "\n\n".join(messages)
+
+    def clear_interventions(self, agent_id: str):
+        self.interventions.pop(agent_id, None)
+
+    async def wait_resumed(self):
+        # returns immediately unless paused, waiting takes no thread and ends cleanly when the task is cancelled
+        if not self.paused: return
+        loop = asyncio.get_running_loop()
+        with self.lock: # created with the current state, later changes are delivered by notify_loops
+            event = self.resumed_events.setdefault(loop, asyncio.Event())
+            if self.resumed.is_set(): event.set() # we are in the loop's thread, notifications still queued are overtaken
+            else: event.clear()
+        await event.wait()
+
+
+sessions: dict[str, Control] = {}
+
+def create_session(session_id: str = "") -> Control:
+    session = Control(session_id)
+    sessions[session.id] = session
+    return session
+
+def get_session(session_id: str) -> Control | None:
+    return sessions.get(session_id)
+
+def close_session(session_id: str):
+    session = sessions.pop(session_id, None)
+    if session: session.close()
@@ -2,7 +2,7 @@ import re
 import traceback
 
 def format_error(e: Exception, max_entries=2):
-    traceback_text = traceback.format_exc()
+    traceback_text = "".join(traceback.format_exception(type(e), e, e.__traceback__)) # also works outside of the except block
     # Split the traceback into lines
     lines = traceback_text.split('\n')
     
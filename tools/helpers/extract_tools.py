@@ -1,4 +1,4 @@
-import re, os
+import re, os, json
 from typing import Any
 from .  import files
 # import dirtyjson
@@ -13,6 +13,84 @@ def json_parse_dirty(json:str) -> dict[str,Any]:
     if isinstance(data,dict): return data
     return {}
 
+class JsonStreamParser:
+    # Incrementally scans streamed text and detects when the first top-level JSON object is closed.
+    # Completed string values are collected by key path, e.g. ("tool_args", "question"), so callers can act on them early.
+    # Only double-quoted strings are tracked, the closed object is confirmed by the dirty parser.
+
+    def __init__(self):
+        self.text = ""
+        self.pos = 0
+        self.start = -1
+        self.end = -1
+        self.in_string = False
+        self.escape = False
+        self.string_start = -1
+        self.stack: list[dict] = [] # open containers, objects remember their current key
+        self.values: dict[tuple, str] = {}
+
+    def feed(self, chunk: str) -> bool:
+        self.text += chunk
+        while self.end == -1 and self.pos < len(self.text):
+            self._scan(self.text[self.pos])
+            self.pos += 1
+        return self.end != -1
+
+    def get_value(self, *path: str) -> str | None:
+        return self.values.get(path)
+
+    def _scan(self, char: str):
+        if self.in_string:
+            if self.escape: self.escape = False
+            elif char == "\\": self.escape = True
+            elif char == '"':
+                self.in_string = False
+                self._on_string(self.text[self.string_start:self.pos])
+        elif self.start == -1:
+            if char == "{":
+                self.start = self.pos
+                self.stack.append({"object": True, "key": None, "expect_key": True})
+        elif char == '"':
+            self.in_string = True
+            self.string_start = self.pos + 1
+        elif char in "{[":
+            self.stack.append({"object": char == "{", "key": None, "expect_key": char == "{"})
+        elif char == "," and self.stack and self.stack[-1]["object"]:
+            self.stack[-1]["expect_key"] = True
+        elif char in "}]":
+            if self.stack: self.stack.pop()
+            if not self.stack:
+                if self._is_complete(self.pos + 1): self.end = self.pos + 1
+                else: # stray object in the prose before the tool call, look for the next one
+                    self.start = -1
+                    self.values = {}
+
+    def _on_string(self, raw: str):
+        if not self.stack: return
+        frame = self.stack[-1]
+        try: value = json.loads('"' + raw + '"')
+        except ValueError: value = raw
+        if frame["object"] and frame["expect_key"]:
+            frame["key"] = value
+            frame["expect_key"] = False
+        elif all(f["object"] for f in self.stack): # values inside arrays have no key path
+            self.values[tuple(f["key"] for f in self.stack)] = value
+
+    def _is_complete(self, end: int) -> bool:
+        data = DirtyJson.parse_string(self.text[self.start:end])
+        return isinstance(data, dict) and any(key in data for key in ("tool_name", "tool_calls", "tool_pipeline"))
+
+    def get_object_string(self) -> str:
+        if self.start == -1: return ""
+        return self.text[self.start:self.end if self.end != -1 else len(self.text)]
+
+def get_tool_requests(data: dict[str,Any]) -> list[dict[str,Any]]:
+    # a message holds either a single "tool_name" + "tool_args" request or a list of them in "tool_calls"
+    calls = data.get("tool_calls")
+    if isinstance(calls, list) and calls:
+        return [call for call in calls if isinstance(call, dict)]
+    return [data]
+
 def extract_json_object_string(content):
     start = content.find('{')
     if start == -1:
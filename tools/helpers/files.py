@@ -1,24 +1,60 @@
-import os, re, sys
+import os, re, sys, time
 
-def read_file(relative_path, **kwargs):
-    absolute_path = get_abs_path(relative_path)  # Construct the absolute path to the target file
+placeholder_pattern = re.compile(r"\{\{(\w+)\}\}")
+template_check_interval = 1.0 # seconds between mtime checks of a cached template
+templates: dict[str, "Template"] = {}
+
+class Template:
+    # file content pre-split into literal segments and placeholder names: [text, name, text, name, ..., text]
+    def __init__(self, path: str):
+        self.path = path
+        self.mtime = os.path.getmtime(path)
+        self.checked = time.time()
+        with open(path) as f:
+            self.parts = placeholder_pattern.split(remove_code_fences(f.read()))
+
+    def render(self, **kwargs) -> str:
+        if len(self.parts) == 1: return self.parts[0] # no placeholders
+        # placeholders without a value are kept as they are
+        return "".join(part if i % 2 == 0 else (str(kwargs[part]) if part in kwargs else "{{" + part + "}}")
+                       for i, part in enumerate(self.parts))
 
-    with open(absolute_path) as f:
-        content = remove_code_fences(f.read())
+    def is_stale(self) -> bool:
+        now = time.time()
+        if now - self.checked < template_check_interval: return False
+        self.checked = now
+        try: return os.path.getmtime(self.path) != self.mtime
+        except OSError: return True
 
-    # Replace placeholders with values from kwargs
-    for key, value in kwargs.items():
-        placeholder = "{{" + key + "}}"
-        strval = str(value)
-        # strval = strval.encode('unicode_escape').decode('utf-8')
-        # content = re.sub(re.escape(placeholder), strval, content)
-        content = content.replace(placeholder, strval)
+def read_file(relative_path, **kwargs):
+    absolute_path = os.path.normpath(get_abs_path(relative_path))  # Construct the absolute path to the target file
+    return get_template(absolute_path).render(**kwargs) # Replace placeholders with values from kwargs
+
+def get_template(absolute_path: str) -> Template:
+    template = templates.get(absolute_path)
+    if not template or template.is_stale():
+        template = templates[absolute_path] = Template(absolute_path)
+    return template
 
-    return content
+def preload_templates(relative_dir="prompts"):
+    # parse all prompt files once, later reads are served from memory
+    directory = get_abs_path(relative_dir)
+    for file in os.listdir(directory):
+        path = os.path.normpath(os.path.join(directory, file))
+        if os.path.isfile(path): get_template(path)
 
 def remove_code_fences(text):
     return re.sub(r'~~~\w*\n|~~~', '', text)
 
+def get_work_dir(work_dir="work_dir", tmpfs=False):
+    # relative paths are resolved against the base dir, tmpfs places the directory in shared memory for I/O heavy jobs
+    if tmpfs and os.path.isdir("/dev/shm"):
+        path = os.path.join("/dev/shm", "agent-zero", work_dir.lstrip("/"))
+    else:
+        path = get_abs_path(work_dir)
+    os.makedirs(path, exist_ok=True)
+    return path
+
 def get_abs_path(*relative_paths):
     return os.path.join(get_base_dir(), *relative_paths)
 
@@ -30,4 +66,4 @@ def exists(*relative_paths):
 def get_base_dir():
     # Get the base directory from the current file path
     base_dir = os.path.dirname(os.path.abspath(os.path.join(__file__,"../../")))
-    return base_dir
\ No newline at end of file
+    return base_dir
@@ -0,0 +1,277 @@
+import os, json, math, random, threading, heapq, uuid
+import numpy as np
+from langchain_core.documents import Document
+
+class HNSWStore:
+    # In-process HNSW index implementing the part of the langchain Chroma API that VectorDB uses.
+    # Vectors, graph links, document ids and texts live in memory-mapped files in `directory`,
+    # so opening only maps the files and inserts write straight into them. meta.json holds the counters
+    # and is replaced atomically after each batch of inserts, documents are only visible up to its count.
+    # It is marked dirty before a batch starts writing, links to nodes past the count left by a batch
+    # that never committed are dropped when a dirty store is opened.
+    # Vectors are normalized, scores are squared L2 distances (2 - 2 * cosine) like Chroma's default.
+    #
+    # Up to `exact_limit` documents, searches scan all vectors with one matrix product and inserts link
+    # the exact nearest neighbors the same way, which is faster than walking the graph in Python.
+    # Past that, the graph built so far is used: the walk is pure Python and costs a few ms per search or insert,
+    # so for large stores Chroma is the better backend.
+
+    def __init__(self, embedding_function, directory: str, m: int = 16, ef_construction: int = 100, ef_search: int = 64, max_levels: int = 8, initial_capacity: int = 1024, exact_limit: int = 20000):
+        self.embedding_function = embedding_function
+        self.directory = directory
+        self.ef_construction = ef_construction
+        self.ef_search = ef_search
+        self.exact_limit = exact_limit
+        self.initial_capacity = initial_capacity
+        self.lock = threading.RLock() # searches and inserts come from several worker threads
+        self.maps: dict[str, np.memmap] = {}
+        os.makedirs(directory, exist_ok=True)
+
+        self.meta_path = os.path.join(directory, "meta.json")
+        if os.path.exists(self.meta_path):
+            with open(self.meta_path) as f: self.meta = json.load(f)
+            self.open_maps()
+            if self.meta.get("dirty"):
+                self.drop_uncommitted_links()
+                self.save_meta()
+        else:
+            # the vector dimension is known with the first document, files are created then
+            self.meta = {"dim": 0, "m": m, "max_levels": max_levels, "count": 0, "upper_count": 0,
+                         "capacity": 0, "upper_capacity": 0, "entry": -1, "max_level": -1, "text_size": 0}
+
+        self.m = self.meta["m"]
+        self.max_levels = self.meta["max_levels"]
+        self.level_mult = 1 / math.log(self.m)
+        self.texts = os.open(os.path.join(directory, "texts.bin"), os.O_RDWR | os.O_CREAT)
+
+    # file layout: name -> (dtype, shape of one row, fill value of new rows, counter the rows belong to)
+    def get_layout(self) -> dict:
+        return {
+            "vectors": (np.float32, (self.meta["dim"],), 0, "capacity"),
+            "links0": (np.int32, (2 * self.meta["m"],), -1, "capacity"), # level 0 neighbors
+            "nodes": (np.int32, (3,), -1, "capacity"), # level, slot in "upper", deleted flag
+            "ids": ("S36", (), b"", "capacity"), # uuid strings
+            "offsets": (np.int64, (2,), 0, "capacity"), # position and length in texts.bin
+            "upper": (np.int32, (self.meta["max_levels"] - 1, self.meta["m"]), -1, "upper_capacity"), # neighbors on levels 1+
+        }
+
+    def open_maps(self):
+        for name, (dtype, shape, fill, rows) in self.get_layout().items():
+            if not self.meta[rows]: continue # created by grow() once needed
+            self.maps[name] = np.memmap(os.path.join(self.directory, name), dtype=dtype, mode="r+", shape=(self.meta[rows],) + shape)
+
+    def drop_uncommitted_links(self):
+        # back links are written into existing nodes before the count is committed, a crash in between leaves
+        # links to slots that will be reused by the next insert; scans all links, so only done after such a crash
+        count = self.meta["count"]
+        for name, rows in (("links0", count), ("upper", self.meta["upper_count"])):
+            if name not in self.maps: continue
+            links = self.maps[name][:rows]
+            links[links >= count] = -1
+
+    def grow(self, rows: str, needed: int):
+        # double the capacity of all files counted by `rows`, new rows are filled with their empty value
+        old = self.meta[rows]
+        if needed <= old: return
+        new = max(old * 2, self.initial_capacity, needed)
+        for name, (dtype, shape, fill, counter) in self.get_layout().items():
+            if counter != rows: continue
+            path = os.path.join(self.directory, name)
+            if name in self.maps:
+                self.maps[name].flush()
+                del self.maps[name]
+            with open(path, "ab") as f: f.truncate(new * int(np.prod(shape, dtype=np.int64)) * np.dtype(dtype).itemsize)
+            self.maps[name] = np.memmap(path, dtype=dtype, mode="r+", shape=(new,) + shape)
+            self.maps[name][old:] = fill
+        self.meta[rows] = new
+
+    def save_meta(self, dirty: bool = False):
+        # dirty: a batch of inserts is about to write into the files, cleared by the save that commits it
+        self.meta["dirty"] = dirty
+        path = self.meta_path + ".tmp"
+        with open(path, "w") as f: json.dump(self.meta, f)
+        os.replace(path, self.meta_path)
+
+    def get_links(self, node: int, level: int) -> list[int]:
+        row = self.maps["links0"][node] if level == 0 else self.maps["upper"][self.maps["nodes"][node][1], level - 1]
+        return row[row >= 0].tolist()
+
+    def set_links(self, node: int, level: int, links: list[int]):
+        row = self.maps["links0"][node] if level == 0 else self.maps["upper"][self.maps["nodes"][node][1], level - 1]
+        row[:] = -1
+        row[:len(links)] = links
+
+    def get_distances(self, vector: np.ndarray, nodes: list[int]) -> list[float]:
+        return (1 - self.maps["vectors"][nodes] @ vector).tolist()
+
+    def search_layer(self, vector: np.ndarray, entries: list[int], ef: int, level: int, skip_deleted: bool = False) -> list[tuple[float, int]]:
+        # best-first search on one level, returns up to ef (distance, node) pairs, closest first;
+        # with skip_deleted, deleted nodes are still walked through but do not take places in the results
+        deleted = self.maps["nodes"][:, 2]
+        visited = set(entries)
+        candidates = list(zip(self.get_distances(vector, entries), entries))
+        heapq.heapify(candidates)
+        results = [(-distance, node) for distance, node in candidates if not (skip_deleted and deleted[node])]
+        heapq.heapify(results)
+        while len(results) > ef: heapq.heappop(results)
+
+        while candidates:
+            distance, node = heapq.heappop(candidates)
+            if len(results) >= ef and distance > -results[0][0]: break
+            neighbors = [neighbor for neighbor in self.get_links(node, level) if neighbor not in visited]
+            if not neighbors: continue
+            visited.update(neighbors)
+            for distance, neighbor in zip(self.get_distances(vector, neighbors), neighbors):
+                if len(results) < ef or distance < -results[0][0]:
+                    heapq.heappush(candidates, (distance, neighbor))
+                    if skip_deleted and deleted[neighbor]: continue
+                    heapq.heappush(results, (-distance, neighbor))
+                    if len(results) > ef: heapq.heappop(results)
+        return sorted((-distance, node) for distance, node in results)
+
+    def search_exact(self, vector: np.ndarray, k: int, count: int, min_level: int = 0, skip_deleted: bool = False) -> list[tuple[float, int]]:
+        # k closest of the first `count` nodes that reach `min_level`, by scanning all vectors at once
+        if not count: return []
+        distances = 1 - self.maps["vectors"][:count] @ vector
+        nodes = self.maps["nodes"][:count]
+        excluded = nodes[:, 0] < min_level
+        if skip_deleted: excluded |= nodes[:, 2] != 0
+        distances[excluded] = np.inf
+        k = min(k, count - int(excluded.sum()))
+        if k <= 0: return []
+        closest = np.argpartition(distances, k - 1)[:k]
+        closest = closest[np.argsort(distances[closest])]
+        return list(zip(distances[closest].tolist(), closest.tolist()))
+
+    def insert(self, vector: np.ndarray, id: str, text: str):
+        if not self.meta["dim"]:
+            self.meta["dim"] = len(vector)
+        node = self.meta["count"]
+        self.grow("capacity", node + 1)
+        level = min(int(-math.log(1 - random.random()) * self.level_mult), self.max_levels - 1)
+        slot = -1
+        if level > 0:
+            slot = self.meta["upper_count"]
+            self.grow("upper_capacity", slot + 1)
+            self.meta["upper_count"] += 1
+
+        data = text.encode()
+        os.pwrite(self.texts, data, self.meta["text_size"])
+        self.maps["offsets"][node] = (self.meta["text_size"], len(data))
+        self.meta["text_size"] += len(data)
+        self.maps["vectors"][node] = vector
+        self.maps["ids"][node] = id.encode()
+        self.maps["nodes"][node] = (level, slot, 0)
+
+        entry, max_level = self.meta["entry"], self.meta["max_level"]
+        if entry >= 0 and node <= self.exact_limit:
+            for current in range(min(level, max_level), -1, -1):
+                neighbors = [neighbor for _, neighbor in self.search_exact(vector, self.m, node, min_level=current)]
+                self.set_links(node, current, neighbors)
+                self.connect(neighbors, node, current)
+        elif entry >= 0:
+            entries = [entry]
+            for current in range(max_level, level, -1):
+                entries = [self.search_layer(vector, entries, 1, current)[0][1]]
+            for current in range(min(level, max_level), -1, -1):
+                found = self.search_layer(vector, entries, self.ef_construction, current)
+                neighbors = [neighbor for _, neighbor in found[:self.m]]
+                self.set_links(node, current, neighbors)
+                self.connect(neighbors, node, current)
+                entries = [neighbor for _, neighbor in found]
+
+        self.meta["count"] += 1
+        if level > max_level: self.meta["entry"], self.meta["max_level"] = node, level
+
+    def connect(self, nodes: list[int], neighbor: int, level: int):
+        # add a back link from each of `nodes` to `neighbor`, full link lists keep only their closest neighbors
+        if not nodes: return
+        nodes = np.asarray(nodes)
+        if level == 0: table, index = self.maps["links0"], nodes
+        else: table, index = self.maps["upper"][:, level - 1], self.maps["nodes"][nodes, 1]
+        rows = table[index]
+        free = rows < 0
+        has_free = free.any(axis=1)
+        rows[has_free, free.argmax(axis=1)[has_free]] = neighbor
+        full = ~has_free
+        if full.any():
+            links = np.concatenate([rows[full], np.full((int(full.sum()), 1), neighbor, dtype=rows.dtype)], axis=1)
+            vectors = self.maps["vectors"]
+            distances = 1 - np.einsum("nld,nd->nl", vectors[links], vectors[nodes[full]])
+            rows[full] = np.take_along_axis(links, np.argsort(distances, axis=1)[:, :rows.shape[1]], axis=1)
+        table[index] = rows
+
+    def search(self, vector: np.ndarray, k: int) -> list[tuple[float, int]]:
+        # k closest nodes that are not deleted, as (cosine distance, node)
+        if self.meta["entry"] < 0: return []
+        if self.meta["count"] <= self.exact_limit: return self.search_exact(vector, k, self.meta["count"], skip_deleted=True)
+        entries = [self.meta["entry"]]
+        for level in range(self.meta["max_level"], 0, -1):
+            entries = [self.search_layer(vector, entries, 1, level)[0][1]]
+        return self.search_layer(vector, entries, max(self.ef_search, k), 0, skip_deleted=True)[:k]
+
+    def get_document(self, node: int) -> Document:
+        offset, length = self.maps["offsets"][node]
+        text = os.pread(self.texts, int(length), int(offset)).decode()
+        return Document(text, metadata={"id": self.maps["ids"][node].decode()})
+
+    def embed_query(self, query: str) -> np.ndarray:
+        return normalize(np.asarray(self.embedding_function.embed_query(query), dtype=np.float32))
+
+    def add_documents(self, documents: list[Document]) -> list[str]:
+        vectors = self.embedding_function.embed_documents([doc.page_content for doc in documents])
+        ids = [str(doc.metadata.get("id") or uuid.uuid4()) for doc in documents]
+        with self.lock:
+            self.save_meta(dirty=True)
+            for doc, vector, id in zip(documents, vectors, ids):
+                self.insert(normalize(np.asarray(vector, dtype=np.float32)), id, doc.page_content)
+            self.save_meta()
+        return ids
+
+    def similarity_search_with_score(self, query: str, k: int = 4) -> list[tuple[Document, float]]:
+        vector = self.embed_query(query)
+        with self.lock:
+            return [(self.get_document(node), 2 * distance) for distance, node in self.search(vector, k)]
+
+    def similarity_search(self, query: str, k: int = 4) -> list[Document]:
+        return [doc for doc, _ in self.similarity_search_with_score(query, k)]
+
+    def max_marginal_relevance_search(self, query: str, k: int = 4, fetch_k: int = 20, lambda_mult: float = 0.5) -> list[Document]:
+        return self.max_marginal_relevance_search_by_vector(self.embed_query(query), k, fetch_k, lambda_mult)
+
+    def max_marginal_relevance_search_by_vector(self, embedding, k: int = 4, fetch_k: int = 20, lambda_mult: float = 0.5) -> list[Document]:
+        # relevant to the query but different from each other, picked from the fetch_k closest
+        vector = normalize(np.asarray(embedding, dtype=np.float32))
+        with self.lock:
+            nodes = [node for _, node in self.search(vector, max(fetch_k, k))]
+            if not nodes: return []
+            vectors = np.asarray(self.maps["vectors"][nodes])
+            relevance = vectors @ vector
+            selected = [int(np.argmax(relevance))]
+            while len(selected) < min(k, len(nodes)):
+                redundancy = (vectors @ vectors[selected].T).max(axis=1)
+                scores = lambda_mult * relevance - (1 - lambda_mult) * redundancy
+                scores[selected] = -np.inf
+                selected.append(int(np.argmax(scores)))
+            return [self.get_document(nodes[index]) for index in selected]
+
+    def get(self, where: dict) -> dict:
+        # only {"id": {"$in": [...]}} is supported, returns the ids of live documents
+        ids = where.get("id", {}).get("$in", [])
+        with self.lock:
+            return {"ids": [self.maps["ids"][node].decode() for node in self.find_nodes(ids)]}
+
+    def delete(self, ids: list[str]):
+        # deleted nodes stay in the graph for navigation, searches walk through them without returning them
+        with self.lock:
+            for node in self.find_nodes(ids): self.maps["nodes"][node][2] = 1
+
+    def find_nodes(self, ids: list[str]) -> list[int]:
+        count = self.meta["count"]
+        if not count or not ids: return []
+        matches = np.isin(self.maps["ids"][:count], [id.encode() for id in ids]) & (self.maps["nodes"][:count, 2] == 0)
+        return np.nonzero(matches)[0].tolist()
+
+def normalize(vector: np.ndarray) -> np.ndarray:
+    norm = np.linalg.norm(vector)
+    return vector / norm if norm else vector
@@ -0,0 +1,97 @@
+import re, json, hashlib
+from collections import deque
+
+# escalation levels returned by LoopDetector.record
+NONE, CORRECT, SWITCH_STRATEGY, ABORT = 0, 1, 2, 3
+
+class Observation:
+    def __init__(self, tool_name: str, tool_args: dict, result: str):
+        self.description = describe_call(tool_name, tool_args)
+        self.call = fingerprint(normalize(tool_name) + " " + json.dumps(normalize_args(tool_args), sort_keys=True, default=str))
+        result = normalize(result, numbers=True)
+        self.result = fingerprint(result)
+        features = get_features(result)
+        self.result_features = len(features)
+        self.result_simhash = simhash(features)
+
+class LoopDetector:
+    # A call is a repeat when an earlier call in the window had the same tool and args (key order and whitespace do not matter)
+    # and got the same result, compared after normalizing whitespace, case and numbers (timestamps, pids, durations).
+    # Long results may also match when their simhash differs by a few bits, the allowed distance shrinks with
+    # the number of features, so short outputs like "ok" or a single path only match exactly.
+    # Every `threshold` consecutive repeats raise the escalation level by one.
+
+    def __init__(self, window: int = 8, threshold: int = 2, max_distance: int = 3, full_features: int = 64):
+        self.window = window
+        self.threshold = threshold
+        self.max_distance = max_distance # bits out of 64 two long results may differ to count as the same
+        self.full_features = full_features # results with fewer features get a proportionally smaller distance
+        self.observations: deque[Observation] = deque(maxlen=window)
+        self.repeats = 0
+        self.repeated: list[str] = [] # descriptions of the repeated calls, for the report
+
+    def record(self, tool_name: str, tool_args: dict, result: str) -> int:
+        observation = Observation(tool_name, tool_args, str(result))
+        repeat = any(observation.call == old.call and self.is_same_result(observation, old) for old in self.observations)
+        self.observations.append(observation)
+
+        if not repeat:
+            self.repeats = 0
+            self.repeated = []
+            return NONE
+
+        self.repeats += 1
+        if observation.description not in self.repeated: self.repeated.append(observation.description)
+        if self.repeats % self.threshold: return NONE # escalate once per `threshold` repeats
+        return min(self.repeats // self.threshold, ABORT)
+
+    def is_same_result(self, a: Observation, b: Observation) -> bool:
+        if a.result == b.result: return True
+        features = min(a.result_features, b.result_features, self.full_features)
+        limit = self.max_distance * features // self.full_features
+        return limit > 0 and distance(a.result_simhash, b.result_simhash) <= limit
+
+    def get_report(self) -> str:
+        return "\n".join(f"- {description}" for description in self.repeated)
+
+    def reset(self):
+        self.observations.clear()
+        self.repeats = 0
+        self.repeated = []
+
+def normalize(text: str, numbers: bool = False) -> str:
+    text = re.sub(r"\s+", " ", text.lower()).strip()
+    if numbers: text = re.sub(r"\d+", "0", text) # timestamps, pids, durations etc. in tool output
+    return text
+
+def normalize_args(value):
+    # whitespace in string values is collapsed, case is kept since commands and paths are case sensitive
+    if isinstance(value, str): return re.sub(r"\s+", " ", value).strip()
+    if isinstance(value, dict): return {key: normalize_args(val) for key, val in value.items()}
+    if isinstance(value, list): return [normalize_args(val) for val in value]
+    return value
+
+def fingerprint(text: str) -> bytes:
+    return hashlib.blake2b(text.encode(), digest_size=16).digest()
+
+def get_features(text: str) -> list[str]:
+    # words and word pairs
+    words = re.findall(r"\w+|[^\w\s]", text)
+    return words + [a + " " + b for a, b in zip(words, words[1:])]
+
+def simhash(features: list[str], bits: int = 64) -> int:
+    # each feature votes on every bit of the fingerprint
+    votes = [0] * bits
+    for feature in features:
+        value = int.from_bytes(hashlib.blake2b(feature.encode(), digest_size=bits // 8).digest(), "big")
+        for bit in range(bits):
+            votes[bit] += 1 if value >> bit & 1 else -1
+    return sum(1 << bit for bit in range(bits) if votes[bit] > 0)
+
+def distance(a: int, b: int) -> int:
+    return bin(a ^ b).count("1")
+
+def describe_call(tool_name: str, tool_args: dict, max_length: int = 200) -> str:
+    args = json.dumps(tool_args, ensure_ascii=False, default=str)
+    if len(args) > max_length: args = args[:max_length] + "..."
+    return f"{tool_name} {args}"
@@ -0,0 +1,38 @@
+import re
+from typing import Any
+
+# {{result}} is the output of the previous step, {{result.N}} the output of step N (counted from 1)
+reference_pattern = re.compile(r"\{\{result(?:\.(\d+))?\}\}")
+
+def resolve_references(value: Any, results: list[str]) -> Any:
+    if isinstance(value, str):
+        def replace(match):
+            index = int(match.group(1)) - 1 if match.group(1) else len(results) - 1
+            return results[index] if 0 <= index < len(results) else match.group(0)
+        return reference_pattern.sub(replace, value)
+    if isinstance(value, dict):
+        return {key: resolve_references(val, results) for key, val in value.items()}
+    if isinstance(value, list):
+        return [resolve_references(val, results) for val in value]
+    return value
+
+def get_failure(step: dict, output: str, exit_code: int | None = None) -> str:
+    # a process that exits with a non-zero status fails the step, unless "ignore_exit_code" is true
+    # "fail_if": step fails when any of the texts is in the output
+    # "fail_unless": step fails when none of the texts is in the output
+    if exit_code and str(step.get("ignore_exit_code", "")).lower().strip() != "true":
+        return f"exit code {exit_code}"
+
+    fail_if = as_list(step.get("fail_if"))
+    found = [text for text in fail_if if text in output]
+    if found: return f"output contains '{found[0]}'"
+
+    fail_unless = as_list(step.get("fail_unless"))
+    if fail_unless and not any(text in output for text in fail_unless):
+        return f"output does not contain '{fail_unless[0]}'"
+    return ""
+
+def as_list(value: Any) -> list[str]:
+    if value is None or value == "": return []
+    if isinstance(value, list): return [str(val) for val in value]
+    return [str(value)]
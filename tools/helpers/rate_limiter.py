@@ -1,4 +1,4 @@
-import time
+import time, asyncio
 from collections import deque
 from dataclasses import dataclass
 from typing import List, Tuple
@@ -28,29 +28,46 @@ class RateLimiter:
         output_tokens = sum(record.output_tokens for record in self.call_records)
         return calls, input_tokens, output_tokens
 
+    def _get_wait_time(self, current_time: float, new_input_tokens: int) -> Tuple[float, List[str]]:
+        self._clean_old_records(current_time)
+        calls, input_tokens, output_tokens = self._get_counts()
+        
+        wait_reasons = []
+        if self.max_calls > 0 and calls >= self.max_calls:
+            wait_reasons.append("max calls")
+        if self.max_input_tokens > 0 and input_tokens + new_input_tokens > self.max_input_tokens:
+            wait_reasons.append("max input tokens")
+        if self.max_output_tokens > 0 and output_tokens >= self.max_output_tokens:
+            wait_reasons.append("max output tokens")
+        
+        if not wait_reasons or not self.call_records:
+            return 0, []
+        
+        oldest_record = self.call_records[0]
+        wait_time = oldest_record.timestamp + self.window_seconds - current_time
+        return max(wait_time, 0), wait_reasons
+
+    def _print_wait(self, wait_time: float, wait_reasons: List[str]):
+        PrintStyle(font_color="yellow", padding=True).print(f"Rate limit exceeded. Waiting for {wait_time:.2f} seconds due to: {', '.join(wait_reasons)}")
+
     def _wait_if_needed(self, current_time: float, new_input_tokens: int):
         while True:
-            self._clean_old_records(current_time)
-            calls, input_tokens, output_tokens = self._get_counts()
-            
-            wait_reasons = []
-            if self.max_calls > 0 and calls >= self.max_calls:
-                wait_reasons.append("max calls")
-            if self.max_input_tokens > 0 and input_tokens + new_input_tokens > self.max_input_tokens:
-                wait_reasons.append("max input tokens")
-            if self.max_output_tokens > 0 and output_tokens >= self.max_output_tokens:
-                wait_reasons.append("max output tokens")
-            
-            if not wait_reasons:
-                break
-            
-            oldest_record = self.call_records[0]
-            wait_time = oldest_record.timestamp + self.window_seconds - current_time
+            wait_time, wait_reasons = self._get_wait_time(current_time, new_input_tokens)
+            if not wait_reasons: break
             if wait_time > 0:
-                PrintStyle(font_color="yellow", padding=True).print(f"Rate limit exceeded. Waiting for {wait_time:.2f} seconds due to: {', '.join(wait_reasons)}")
+                self._print_wait(wait_time, wait_reasons)
                 time.sleep(wait_time)
             current_time = time.time()
 
+    async def _await_if_needed(self, current_time: float, new_input_tokens: int):
+        while True:
+            wait_time, wait_reasons = self._get_wait_time(current_time, new_input_tokens)
+            if not wait_reasons: break
+            if wait_time > 0:
+                self._print_wait(wait_time, wait_reasons)
+                await asyncio.sleep(wait_time) # only this coroutine waits, other agents keep running
+            current_time = time.time()
+
     def limit_call_and_input(self, input_token_count: int) -> CallRecord:
         current_time = time.time()
         self._wait_if_needed(current_time, input_token_count)
@@ -58,11 +75,23 @@ class RateLimiter:
         self.call_records.append(new_record)
         return new_record
 
+    async def alimit_call_and_input(self, input_token_count: int) -> CallRecord:
+        await self._await_if_needed(time.time(), input_token_count)
+        new_record = CallRecord(time.time(), input_token_count)
+        self.call_records.append(new_record)
+        return new_record
+
     def set_output_tokens(self, output_token_count: int):
         if self.call_records:
             self.call_records[-1].output_tokens += output_token_count
         return self
 
+    def reconcile(self, record: CallRecord, input_token_count: int | None = None, output_token_count: int | None = None):
+        # replace estimates with the token counts reported by the provider once the call is done
+        if input_token_count is not None: record.input_tokens = input_token_count
+        if output_token_count is not None: record.output_tokens = output_token_count
+        return self
+
 # Example usage
 rate_limiter = RateLimiter(max_calls=5, max_input_tokens=1000, max_output_tokens=2000)
 
@@ -5,12 +5,18 @@ from tools.helpers.print_style import PrintStyle
 from tools.helpers import files, messages
 
 class Response:
-    def __init__(self, message: str, break_loop: bool) -> None:
+    def __init__(self, message: str, break_loop: bool, exit_code: int | None = None) -> None:
         self.message = message
         self.break_loop = break_loop
+        self.exit_code = exit_code # exit status of a process the tool ran, None if there was none
     
 class Tool:
 
+    side_effect_free = False # tool only reads data, it can be started early or run in parallel
+    speculative_args: tuple[str, ...] = () # args that have to be known before a speculative start
+    timeout: float | None = None # seconds the tool may run, None for no limit
+    max_concurrency: int = 0 # instances that may run at once, 0 for no limit
+
     def __init__(self, agent: Agent, name: str, args: dict[str,str], message: str, **kwargs) -> None:
         self.agent = agent
         self.name = name
@@ -18,10 +24,13 @@ class Tool:
         self.message = message
 
     @abstractmethod
-    def execute(self,**kwargs) -> Response:
+    async def execute(self,**kwargs) -> Response:
         pass
 
-    def before_execution(self, **kwargs):
+    def is_side_effect_free(self) -> bool:
+        return self.side_effect_free
+
+    async def before_execution(self, **kwargs):
         PrintStyle(font_color="#1B4F72", padding=True, background_color="white", bold=True).print(f"{self.agent.agent_name}: Using tool '{self.name}':")
         if self.args and isinstance(self.args, dict):
             for key, value in self.args.items():
@@ -29,10 +38,10 @@ class Tool:
                 PrintStyle(font_color="#85C1E9", padding=isinstance(value,str) and "\n" in value).stream(value)
                 PrintStyle().print()
                     
-    def after_execution(self, response: Response, **kwargs):
+    async def after_execution(self, response: Response, **kwargs):
         text = messages.truncate_text(response.message.strip(), self.agent.max_tool_response_length)
         msg_response = files.read_file("./prompts/fw.tool_response.md", tool_name=self.name, tool_response=text)
-        self.agent.append_message(msg_response, human=True)
+        await self.agent.append_message(msg_response, human=True)
         PrintStyle(font_color="#1B4F72", background_color="white", padding=True, bold=True).print(f"{self.agent.agent_name}: Response from tool '{self.name}':")
         PrintStyle(font_color="#85C1E9").print(response.message)
 
@@ -0,0 +1,93 @@
+import asyncio, importlib, inspect, os, weakref
+from typing import Any
+from . import files, errors
+from .print_style import PrintStyle
+
+class ToolInfo:
+    def __init__(self, name: str, tool_class: type, module: Any, mtime: float):
+        self.name = name
+        self.tool_class = tool_class
+        self.module = module
+        self.mtime = mtime
+        self.args = get_arg_schema(tool_class)
+        self.timeout: float | None = getattr(tool_class, "timeout", None) # seconds, None for no limit
+        self.max_concurrency: int = getattr(tool_class, "max_concurrency", 0) # running instances per event loop, 0 for no limit
+        self.semaphores = weakref.WeakKeyDictionary() # asyncio semaphores are bound to their event loop
+
+    def get_semaphore(self):
+        loop = asyncio.get_running_loop()
+        if loop not in self.semaphores: self.semaphores[loop] = asyncio.Semaphore(self.max_concurrency)
+        return self.semaphores[loop]
+
+class ToolRegistry:
+    # Tools are discovered once from the tools/ package and looked up by name.
+    # Changed tool files are only picked up by reload(), or on lookup when hot_reload is enabled.
+
+    def __init__(self, package: str = "tools", hot_reload: bool = False):
+        self.package = package
+        self.hot_reload = hot_reload
+        self.tools: dict[str, ToolInfo] = {}
+        self.loaded = False
+
+    def load(self):
+        for name, path in self.list_modules().items():
+            self.load_module(name, path)
+        self.loaded = True
+        return self
+
+    def reload(self):
+        modules = self.list_modules()
+        for name in list(self.tools):
+            if name not in modules: del self.tools[name] # file removed
+        for name, path in modules.items():
+            info = self.tools.get(name)
+            if not info or os.path.getmtime(path) != info.mtime:
+                self.load_module(name, path, reload=info is not None)
+        self.loaded = True
+        return self
+
+    def get(self, name: str) -> ToolInfo | None:
+        if self.hot_reload: self.reload()
+        elif not self.loaded: self.load()
+        return self.tools.get(name)
+
+    def list_modules(self) -> dict[str, str]:
+        directory = files.get_abs_path(self.package)
+        return { file[:-3]: os.path.join(directory, file) for file in sorted(os.listdir(directory))
+                 if file.endswith(".py") and not file.startswith("_") }
+
+    def load_module(self, name: str, path: str, reload: bool = False):
+        from tools.helpers.tool import Tool
+
+        try:
+            module = importlib.import_module(f"{self.package}.{name}")
+            if reload: module = importlib.reload(module)
+        except Exception as e: # a broken tool file must not stop the agent, the previous version stays loaded
+            PrintStyle(font_color="red", padding=True).print(f"Tool '{name}' could not be loaded:\n{errors.format_error(e)}")
+            return
+
+        # prefer the tool class defined in the module itself over imported ones
+        classes = [cls for _, cls in inspect.getmembers(module, inspect.isclass) if cls is not Tool and issubclass(cls, Tool)]
+        classes.sort(key=lambda cls: cls.__module__ != module.__name__)
+        if classes: self.tools[name] = ToolInfo(name, classes[0], module, os.path.getmtime(path))
+        else: self.tools.pop(name, None)
+
+    async def execute(self, tool, **kwargs):
+        # run tool.execute with the per-tool timeout and concurrency limits
+        info = self.tools.get(tool.name)
+        if not info or info.tool_class is not type(tool): return await tool.execute(**kwargs)
+
+        async def run():
+            if not info.max_concurrency: return await tool.execute(**kwargs)
+            async with info.get_semaphore(): return await tool.execute(**kwargs)
+
+        if not info.timeout: return await run()
+        try: return await asyncio.wait_for(run(), info.timeout)
+        except asyncio.TimeoutError: raise TimeoutError(f"Tool '{tool.name}' did not finish within {info.timeout} seconds.")
+
+def get_arg_schema(tool_class: type) -> list[str]:
+    # named arguments of the tool's execute method
+    parameters = inspect.signature(tool_class.execute).parameters.values()
+    return [param.name for param in parameters if param.name != "self" and param.kind not in (param.VAR_KEYWORD, param.VAR_POSITIONAL)]
+
+registry = ToolRegistry()
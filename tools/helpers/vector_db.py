@@ -2,15 +2,57 @@ from langchain.storage import InMemoryByteStore, LocalFileStore
 from langchain.embeddings import CacheBackedEmbeddings
 from langchain_chroma import Chroma
 from . import files
+from .hnsw import HNSWStore
 from langchain_core.documents import Document
-import uuid
+from langchain_core.embeddings import Embeddings
+from collections import OrderedDict
+import uuid, hashlib, json, threading, itertools
+
+
+class QueryCacheEmbeddings(Embeddings):
+    # CacheBackedEmbeddings only caches embed_documents, search queries are cached here by content hash
+    # in a bounded LRU, optionally backed by the byte store so they survive restarts;
+    # stored queries are never evicted from the store, so persisting is only meant for a small set of recurring queries
+
+    def __init__(self, embedder: Embeddings, store=None, namespace: str = "", max_size: int = 1024):
+        self.embedder = embedder
+        self.store = store
+        self.namespace = namespace
+        self.max_size = max_size
+        self.cache: OrderedDict[str, list[float]] = OrderedDict()
+        self.lock = threading.Lock() # searches run in worker threads
+
+    def embed_documents(self, texts: list[str]) -> list[list[float]]:
+        return self.embedder.embed_documents(texts)
+
+    def embed_query(self, text: str) -> list[float]:
+        key = hashlib.sha256(text.encode()).hexdigest()
+        with self.lock:
+            vector = self.cache.get(key)
+            if vector is not None:
+                self.cache.move_to_end(key)
+                return list(vector)
+
+        store_key = f"{self.namespace}query_{key}"
+        stored = self.store.mget([store_key])[0] if self.store is not None else None
+        if stored: vector = json.loads(stored)
+        else:
+            vector = self.embedder.embed_query(text)
+            if self.store is not None: self.store.mset([(store_key, json.dumps(vector).encode())])
+
+        with self.lock:
+            self.cache[key] = vector
+            self.cache.move_to_end(key)
+            while len(self.cache) > self.max_size: self.cache.popitem(last=False)
+        return list(vector)
 
 
 class VectorDB:
 
-    def __init__(self, embeddings_model, in_memory=False, cache_dir="./cache"):
+    def __init__(self, embeddings_model, in_memory=False, cache_dir="./cache", query_cache_size=1024, persist_queries=False, backend="chroma"):
         print("Initializing VectorDB...")
         self.embeddings_model = embeddings_model
+        self.version = 0 # incremented on every change of the stored documents
 
         em_cache = files.get_abs_path(cache_dir,"embeddings")
         db_cache = files.get_abs_path(cache_dir,"database")
@@ -22,12 +64,19 @@ class VectorDB:
 
 
         #here we setup the embeddings model with the chosen cache storage
-        self.embedder = CacheBackedEmbeddings.from_bytes_store(
-            embeddings_model, 
-            self.store, 
-            namespace=getattr(embeddings_model, 'model', getattr(embeddings_model, 'model_name', "default")) )
+        namespace = getattr(embeddings_model, 'model', getattr(embeddings_model, 'model_name', "default"))
+        self.embedder = QueryCacheEmbeddings(
+            CacheBackedEmbeddings.from_bytes_store(embeddings_model, self.store, namespace=namespace),
+            store=self.store if persist_queries else None,
+            namespace=namespace,
+            max_size=query_cache_size)
 
-        self.db = Chroma(embedding_function=self.embedder,persist_directory=db_cache)
+        if in_memory: # nothing on disk, in-process Chroma clients share collections, so each store gets its own
+            self.db = Chroma(embedding_function=self.embedder, collection_name=f"memory_{uuid.uuid4().hex}")
+        elif backend == "hnsw": # native index in memory-mapped files, same interface as used from Chroma below
+            self.db = HNSWStore(embedding_function=self.embedder, directory=files.get_abs_path(cache_dir,"hnsw"))
+        else:
+            self.db = Chroma(embedding_function=self.embedder,persist_directory=db_cache)
         
     def search_similarity(self, query, results=3):
         return self.db.similarity_search(query,results)
@@ -35,6 +84,9 @@ class VectorDB:
     def search_max_rel(self, query, results=3):
         return self.db.max_marginal_relevance_search(query,results)
 
+    def search_max_rel_by_vector(self, vector, results=3):
+        return self.db.max_marginal_relevance_search_by_vector(vector,results)
+
     def delete_documents(self, query):
         score_limit = 1
         k = 2
@@ -49,7 +101,9 @@ class VectorDB:
             # Delete documents with IDs over the threshold score
             if document_ids:
                 fnd = self.db.get(where={"id": {"$in": document_ids}})
-                if fnd["ids"]: self.db.delete(ids=fnd["ids"])
+                if fnd["ids"]:
+                    self.db.delete(ids=fnd["ids"])
+                    self.version += 1
                 tot += len(fnd["ids"])
             
             # If fewer than K document IDs, break the loop
@@ -61,7 +115,54 @@ class VectorDB:
     def insert_document(self, data):
         id = str(uuid.uuid4())
         self.db.add_documents(documents=[ Document(data, metadata={"id": id}) ])
+        self.version += 1
         return id
-        
 
 
+class OverlayDB:
+    # Reads see the documents of a base store and of a private one, saves and deletes only touch the private one.
+    # The private store lives in memory and is created with the first save. Results of both stores are interleaved,
+    # private first, since scores of separate stores are not comparable for MMR searches.
+
+    def __init__(self, base: "VectorDB | OverlayDB"):
+        self.base = base
+        self.embeddings_model = base.embeddings_model
+        self.embedder = base.embedder
+        self.private: VectorDB | None = None
+        self.lock = threading.Lock()
+
+    @property
+    def version(self):
+        return self.base.version + (self.private.version if self.private else 0)
+
+    def search_similarity(self, query, results=3):
+        return self.merge("search_similarity", query, results)
+
+    def search_max_rel(self, query, results=3):
+        return self.merge("search_max_rel", query, results)
+
+    def search_max_rel_by_vector(self, vector, results=3):
+        return self.merge("search_max_rel_by_vector", vector, results)
+
+    def merge(self, method, query, results):
+        base = getattr(self.base, method)(query, results)
+        if not self.private: return base
+        private = getattr(self.private, method)(query, results)
+        merged, seen = [], set()
+        for doc in itertools.chain.from_iterable(itertools.zip_longest(private, base)):
+            if doc is None or doc.page_content in seen: continue
+            seen.add(doc.page_content)
+            merged.append(doc)
+        return merged[:results]
+
+    def delete_documents(self, query):
+        return self.private.delete_documents(query) if self.private else 0
+
+    def insert_document(self, data):
+        with self.lock:
+            if not self.private: self.private = VectorDB(self.embeddings_model, in_memory=True)
+        return self.private.insert_document(data)
+
+    def close(self):
+        if self.private: self.private.db.delete_collection()
+        self.private = None
@@ -1,7 +1,7 @@
 from agent import Agent
 from . import online_knowledge_tool
 from . import memory_tool
-import concurrent.futures
+import asyncio
 
 
 
@@ -9,15 +9,14 @@ from tools.helpers.tool import Tool, Response
 from tools.helpers import files
 
 class Knowledge(Tool):
-    def execute(self, question="", **kwargs):
-        with concurrent.futures.ThreadPoolExecutor() as executor:
-            # Schedule the two functions to be run in parallel
-            future_online = executor.submit(online_knowledge_tool.process_question, question)
-            future_memory = executor.submit(memory_tool.process_query, self.agent, question)
+    side_effect_free = True
+    speculative_args = ("question",)
 
-            # Wait for both functions to complete
-            online_result = future_online.result()
-            memory_result = future_memory.result()
+    async def execute(self, question="", **kwargs):
+        # Run the two blocking lookups in parallel on worker threads and wait for both to complete
+        online_result, memory_result = await asyncio.gather(
+            asyncio.to_thread(online_knowledge_tool.process_question, question),
+            asyncio.to_thread(memory_tool.process_query, self.agent, question))
 
         result = f"# Online sources:\n{online_result}\n\n# Memory:\n{memory_result}"
         return Response(message=result, break_loop=False)
\ No newline at end of file
@@ -1,43 +1,134 @@
 from agent import Agent
-from tools.helpers.vector_db import VectorDB, Document
+from tools.helpers.vector_db import VectorDB, OverlayDB, Document
 from tools.helpers import files
-import os, json
+import os, json, asyncio, threading
 from tools.helpers.tool import Tool, Response
 from tools.helpers.print_style import PrintStyle
 
-db: VectorDB | None = None
+dbs: dict[tuple[str, str], VectorDB] = {} # by (memory_subdir, memory_backend)
+db_lock = threading.Lock()
+reranker = None
+reranker_model = "cross-encoder/ms-marco-MiniLM-L-6-v2"
+reranker_lock = threading.Lock()
 
 class Memory(Tool):
-    def execute(self,**kwargs):
+    speculative_args = ("memory", "action")
+
+    def is_side_effect_free(self) -> bool:
+        return str(self.args.get("action", "")).strip().lower() == "load"
+
+    async def execute(self,**kwargs):
         #TODO separate param for memory tool result count
-        result = process_query(self.agent, self.args["memory"],self.args["action"], result_count=self.agent.auto_memory_count)
+        result = await asyncio.to_thread(process_query, self.agent, self.args["memory"],self.args["action"], result_count=self.agent.auto_memory_count)
         return Response(message="\n\n".join(result), break_loop=False)
             
 
-def initialize(embeddings_model, subdir=""):
-    global db
+def initialize(embeddings_model, subdir="", backend="chroma", persist_queries=False) -> VectorDB:
     dir = os.path.join("memory",subdir)
-    db = VectorDB(embeddings_model=embeddings_model, in_memory=False, cache_dir=dir)
+    return VectorDB(embeddings_model=embeddings_model, in_memory=False, cache_dir=dir, backend=backend, persist_queries=persist_queries)
+
+
+def get_db(agent:Agent) -> VectorDB | OverlayDB:
+    if agent.get_data("memory_isolated"): return get_isolated_db(agent)
+    return get_shared_db(agent)
+
+
+def get_shared_db(agent:Agent) -> VectorDB:
+    # one store per memory directory and backend, reached from worker threads of several agents at once,
+    # only one of them may open each store
+    key = (agent.memory_subdir, agent.memory_backend)
+    db = dbs.get(key)
+    if not db:
+        with db_lock:
+            db = dbs.get(key)
+            if not db: db = dbs[key] = initialize(agent.embeddings_model, subdir=agent.memory_subdir, backend=agent.memory_backend,
+                                                  persist_queries=agent.memory_persist_queries) # the agent opening the store decides
+    return db
+
+
+def get_isolated_db(agent:Agent) -> OverlayDB:
+    # private overlay of one task: it reads the memories of its superior (private ones included, when the superior
+    # is isolated too) but saves and deletes only its own, so parallel subtrees do not overwrite each other
+    db = agent.get_data("memory_db")
+    if db: return db
+    superior = agent.get_data("superior")
+    base = get_db(superior) if superior and superior.get_data("memory_isolated") else get_shared_db(agent)
+    with db_lock:
+        db = agent.get_data("memory_db")
+        if not db:
+            db = OverlayDB(base)
+            agent.set_data("memory_db", db)
+    return db
+
+
+def release_db(agent:Agent):
+    # drops the private memories of the finished task, shared stores stay open
+    db = agent.get_data("memory_db")
+    if db: db.close()
 
 
 def process_query(agent:Agent, message: str, action: str = "load", result_count: int = 3, **kwargs):
-    if not db: initialize(agent.embeddings_model, subdir=agent.memory_subdir)
+    db = get_db(agent)
     
     if action.strip().lower() == "save":
-        id = db.insert_document(str(message)) # type: ignore
+        id = db.insert_document(str(message))
         return files.read_file("./prompts/fw.memory_saved.md")
 
     elif action.strip().lower() == "delete":
-        deleted = db.delete_documents(message) # type: ignore
+        deleted = db.delete_documents(message)
         return files.read_file("./prompts/fw.memories_deleted.md", count=deleted)
 
     else:
         results=[]
-        docs = db.search_max_rel(message,result_count) # type: ignore
+        docs = db.search_max_rel(message,result_count)
         if len(docs)==0: return files.read_file("./prompts/fw.memories_not_found.md", query=message)
         for doc in docs:
             results.append(doc.page_content)
         return results
         # return "\n\n".join(results)
-            
 
+
+def get_recall_query(agent:Agent, window: int = 6, decay: float = 0.7, max_message_length: int = 1000) -> tuple[list[float] | None, str]:
+    # recency-weighted mean of the embeddings of the last messages instead of embedding the whole history,
+    # messages are embedded one by one through the query cache, so only new or changed messages cost a forward pass
+    # returns the normalized vector and the text of the latest messages for reranking
+    db = get_db(agent)
+    messages = [str(msg.content)[:max_message_length] for msg in agent.history[-window:]]
+    messages = [msg for msg in messages if msg.strip()]
+    if not messages: return None, ""
+
+    vector = None
+    for age, message in enumerate(reversed(messages)):
+        embedding = db.embedder.embed_query(message)
+        weight = decay ** age
+        vector = [weight * value for value in embedding] if vector is None else [total + weight * value for total, value in zip(vector, embedding)]
+    norm = sum(value * value for value in vector) ** 0.5 or 1 # type: ignore
+    vector = [value / norm for value in vector] # type: ignore
+    return vector, "\n".join(messages[-2:])[-max_message_length:]
+
+def recall(agent:Agent, vector: list[float], query: str, result_count: int = 3, threshold: float = 0.0):
+    # candidates found by the recall vector are reranked against the latest messages, nothing is returned below the threshold
+    docs = get_db(agent).search_max_rel_by_vector(vector, result_count * 3)
+    return rerank(query, [doc.page_content for doc in docs], threshold)[:result_count]
+
+def get_drift(vector: list[float], previous: list[float]) -> float:
+    # cosine distance of two normalized vectors
+    return 1 - sum(a * b for a, b in zip(vector, previous))
+
+def get_version(agent:Agent) -> int:
+    # changes whenever memories are saved or deleted
+    if agent.get_data("memory_isolated"): db = agent.get_data("memory_db")
+    else: db = dbs.get((agent.memory_subdir, agent.memory_backend))
+    return db.version if db else 0
+
+def rerank(query: str, texts: list[str], threshold: float) -> list[str]:
+    # local cross-encoder scores every (query, memory) pair, relevant memories first
+    global reranker
+    if not texts: return []
+    with reranker_lock:
+        if reranker is None:
+            from sentence_transformers import CrossEncoder # heavy import, only when recall is used
+            reranker = CrossEncoder(reranker_model)
+        scores = reranker.predict([(query, text) for text in texts])
+    ranked = sorted(zip(scores, texts), key=lambda item: item[0], reverse=True)
+    return [text for score, text in ranked if score >= threshold]
@@ -1,11 +1,15 @@
+import asyncio
 from agent import Agent
 from tools.helpers import perplexity_search
 from tools.helpers.tool import Tool, Response
 
 class OnlineKnowledge(Tool):
-    def execute(self,**kwargs):
+    side_effect_free = True
+    speculative_args = ("question",)
+
+    async def execute(self,**kwargs):
         return Response(
-            message=process_question(self.args["question"]),
+            message=await asyncio.to_thread(process_question, self.args["question"]),
             break_loop=False,
         )
 
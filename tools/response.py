@@ -9,12 +9,12 @@ from tools.helpers.print_style import PrintStyle
 
 class ResponseTool(Tool):
 
-    def execute(self,**kwargs):
+    async def execute(self,**kwargs):
         # superior = self.agent.get_data("superior")
         # if superior:
         self.agent.set_data("timeout", 60)
         return Response(message=self.args["text"], break_loop=True)
         # else:
 
-    def after_execution(self, response, **kwargs):
+    async def after_execution(self, response, **kwargs):
         pass # do add anything to the history or output
\ No newline at end of file